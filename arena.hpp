@@ -0,0 +1,177 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace op {
+
+/*
+ * Bump allocator. Memory is taken from big blocks and never returned
+ * one by one: all of it is released at once by clear() or destructor.
+ * Objects created in arena must not need their destructors to be called.
+ */
+
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 1 << 20)
+        : mBlockSize(blockSize)
+        , mBlocks(nullptr)
+        , mPtr(nullptr)
+        , mEnd(nullptr)
+        , mAllocations(0)
+        , mBlocksCount(0)
+        , mBytesReserved(0)
+    {}
+
+    ~Arena() {
+        clear();
+    }
+
+    void * allocate(size_t size, size_t align = sizeof(void*)) {
+        ++mAllocations;
+        char * p = alignUp(mPtr, align);
+        if (p == nullptr || p + size > mEnd) {
+            // big chunks are placed into dedicated blocks to not waste
+            // the rest of the current one
+            if (size > mBlockSize / 4) {
+                return alignUp(newBlock(size + align, false), align);
+            }
+            p = alignUp(newBlock(mBlockSize, true), align);
+        }
+        mPtr = p + size;
+        return p;
+    }
+
+    template <class T>
+    T * allocate(size_t count) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    // copy of data terminated with '\0'
+    const char * copy(const char * data, size_t len) {
+        char * p = static_cast<char*>(allocate(len + 1, 1));
+        memcpy(p, data, len);
+        p[len] = '\0';
+        return p;
+    }
+
+    // release all blocks
+    void clear() {
+        while (mBlocks != nullptr) {
+            Block * next = mBlocks->mNext;
+            ::free(mBlocks);
+            mBlocks = next;
+        }
+        mPtr = mEnd = nullptr;
+    }
+
+    size_t allocations() const {
+        return mAllocations;
+    }
+    size_t blocks() const {
+        return mBlocksCount;
+    }
+    size_t bytesReserved() const {
+        return mBytesReserved;
+    }
+
+private:
+    Arena(const Arena &);
+    Arena & operator=(const Arena &);
+
+    struct Block {
+        Block * mNext;
+    };
+
+    static char * alignUp(char * p, size_t align) {
+        return (char*) (((size_t) p + align - 1) & ~(align - 1));
+    }
+
+    char * newBlock(size_t size, bool current) {
+        Block * block = (Block*) ::malloc(sizeof(Block) + size);
+        if (block == nullptr) throw std::bad_alloc();
+        ++mBlocksCount;
+        mBytesReserved += size;
+        char * data = (char*) (block + 1);
+        if (current || mBlocks == nullptr) {
+            block->mNext = mBlocks;
+            mBlocks = block;
+        } else {
+            // keep the current block on top of the list
+            block->mNext = mBlocks->mNext;
+            mBlocks->mNext = block;
+        }
+        if (current) {
+            mPtr = data;
+            mEnd = data + size;
+        }
+        return data;
+    }
+
+    size_t mBlockSize;
+    Block * mBlocks;
+    char * mPtr;
+    char * mEnd;
+    size_t mAllocations;
+    size_t mBlocksCount;
+    size_t mBytesReserved;
+}; // Arena
+
+/*
+ * STL allocator on top of Arena, deallocate() does nothing.
+ */
+
+template <class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena & arena) : mArena(&arena)
+    {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> & other) : mArena(other.arena())
+    {}
+
+    T * allocate(size_t n) {
+        return mArena->allocate<T>(n);
+    }
+    void deallocate(T *, size_t)
+    {}
+
+    Arena * arena() const {
+        return mArena;
+    }
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U> & other) const {
+        return mArena == other.arena();
+    }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U> & other) const {
+        return mArena != other.arena();
+    }
+
+private:
+    Arena * mArena;
+}; // ArenaAllocator
+
+} // namespace op
@@ -0,0 +1,245 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include "checksum.hpp"
+#include "mflow.hpp"
+#include "flowevents.hpp"
+#include "filefinisher.hpp"
+
+// sum payload the way PCapDumper::build() does: it's cut into segments,
+// pieces of payload are summed on their own and sums of pieces at odd
+// offset of segment are swapped
+uint16_t sumPayload(op::SumFunc f, const uint8_t * data, size_t size,
+                    size_t pieceSize, size_t segmentSize) {
+    uint16_t csum = 0;
+    for (size_t total = 0; total < size; ) {
+        size_t len = std::min(segmentSize, size - total);
+        uint64_t sum = 0;
+        for (size_t done = 0; done < len; ) {
+            size_t n = std::min(pieceSize, len - done);
+            uint64_t s = f(data + total + done, n);
+            sum += ((done & 1) ? op::oddSum(s) : s);
+            done += n;
+        }
+        csum ^= op::checksum(sum);
+        total += len;
+    }
+    return csum;
+}
+
+// sum payload with each checksum implementation, report speed
+int benchChecksum() {
+    // IPv4 segment and odd pieces, e.g. chunks of content
+    const size_t SIZE = 1 << 20, PIECE = 4093, SEGMENT = 0xFFFF - 40, ROUNDS = 1024;
+    std::vector<uint8_t> data(SIZE);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (uint8_t) (i * 7919 + 13);
+    }
+    const op::CHECKSUM impls[] = { op::csumScalar, op::csumSSE2, op::csumAVX2 };
+    int expected = -1;
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); ++k) {
+        op::SumFunc f = op::sumFunc(impls[k]);
+        if (f == nullptr) {
+            std::cout << op::checksumName(impls[k]) << ": not supported" << std::endl;
+            continue;
+        }
+        uint16_t csum = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < ROUNDS; ++r) {
+            // odd lengths check tail handling
+            csum ^= sumPayload(f, data.data(), SIZE - (r & 1), PIECE, SEGMENT);
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << op::checksumName(impls[k]) << ": "
+                  << (int) (SIZE * ROUNDS / secs / (1 << 20)) << " MB/s" << std::endl;
+        if (expected >= 0 && csum != expected) {
+            std::cerr << "ERR: " << op::checksumName(impls[k]) << " checksum differs." << std::endl;
+            return 1;
+        }
+        expected = csum;
+    }
+    return 0;
+}
+
+// netstring of data with type to out
+void appendNetstring(std::string & out, const std::string & data, char type) {
+    std::ostringstream len;
+    len << data.size();
+    out += len.str();
+    out += ':';
+    out += data;
+    out += type;
+}
+
+// http flow of mitmproxy with text content, n makes it unique
+std::string syntheticFlow(size_t n) {
+    static const char * const WORDS[] = {
+        "<div class=\"item\">", "</div>", "<a href=\"/catalog/", "\">", "</a>",
+        "price", "order", "session", "content", "<span>", "</span>\n"
+    };
+    // xorshift, so content of flows doesn't repeat
+    uint32_t x = (uint32_t) n * 2654435761u + 1;
+    std::ostringstream text;
+    for (size_t i = 0; i < 600; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        text << WORDS[x % 11] << (x >> 8) % 100000;
+    }
+    std::ostringstream ts;
+    ts << 1539083574 + n / 10 << "." << n % 10;
+    std::string req, resp, conn, addr, headers, header, flow, item;
+    appendNetstring(header, "Host", ',');
+    appendNetstring(header, "example.com", ',');
+    appendNetstring(headers, header, ']');
+
+    appendNetstring(req, "method", ';');    appendNetstring(req, "GET", ',');
+    appendNetstring(req, "host", ';');      appendNetstring(req, "example.com", ',');
+    appendNetstring(req, "path", ';');      appendNetstring(req, "/catalog", ',');
+    appendNetstring(req, "http_version", ';'); appendNetstring(req, "HTTP/1.1", ',');
+    appendNetstring(req, "headers", ';');   appendNetstring(req, headers, ']');
+    appendNetstring(req, "content", ';');   appendNetstring(req, "", ',');
+    appendNetstring(req, "timestamp_start", ';'); appendNetstring(req, ts.str(), '^');
+
+    appendNetstring(resp, "http_version", ';'); appendNetstring(resp, "HTTP/1.1", ',');
+    appendNetstring(resp, "status_code", ';'); appendNetstring(resp, "200", '#');
+    appendNetstring(resp, "reason", ';');   appendNetstring(resp, "OK", ',');
+    appendNetstring(resp, "headers", ';');  appendNetstring(resp, headers, ']');
+    appendNetstring(resp, "content", ';');  appendNetstring(resp, text.str(), ',');
+    appendNetstring(resp, "timestamp_start", ';'); appendNetstring(resp, ts.str() + "5", '^');
+
+    appendNetstring(addr, "93.184.216.34", ',');
+    appendNetstring(addr, "443", '#');
+    appendNetstring(conn, "ip_address", ';');
+    appendNetstring(conn, addr, ']');
+    addr.clear();
+    appendNetstring(addr, "192.168.1.10", ',');
+    appendNetstring(addr, "50000", '#');
+    appendNetstring(conn, "source_address", ';');
+    appendNetstring(conn, addr, ']');
+
+    std::ostringstream id;
+    id << "flow-" << n;
+    appendNetstring(item, "type", ';');     appendNetstring(item, "http", ',');
+    appendNetstring(item, "id", ';');       appendNetstring(item, id.str(), ',');
+    appendNetstring(item, "request", ';');  appendNetstring(item, req, '}');
+    appendNetstring(item, "response", ';'); appendNetstring(item, resp, '}');
+    appendNetstring(item, "server_conn", ';'); appendNetstring(item, conn, '}');
+    appendNetstring(flow, item, '}');
+    return flow;
+}
+
+// write synthetic flow file without compression, with zstd while writing
+// and gzip after it, then read each of them back by parser
+int benchCompression(const std::string & tempDir) {
+    const size_t FLOWS = 8192;
+    std::string dir = tempDir;
+    if (dir.empty()) {
+        const char * tmp = getenv("TMPDIR");
+        dir = (tmp != nullptr ? tmp : "/tmp");
+    }
+    std::string base = dir + "/mitmproxy2pcap-bench.flow";
+    const op::FileFinisher::COMPRESSION codecs[] = {
+        op::FileFinisher::cmpNone, op::FileFinisher::cmpZstd, op::FileFinisher::cmpGzip
+    };
+    const char * const names[] = { "none", "zstd", "gzip" };
+    const char * const suffixes[] = { "", ".zst", ".gz" };
+    std::string flows;
+    for (size_t n = 0; n < FLOWS; ++n) {
+        flows += syntheticFlow(n);
+    }
+    double bytes = (double) flows.size();
+    for (size_t k = 0; k < 3; ++k) {
+        if (!op::FileFinisher::isSupported(codecs[k])) {
+            std::cout << names[k] << ": not supported" << std::endl;
+            continue;
+        }
+        std::string path = base + (k == 1 ? suffixes[k] : "");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::unique_ptr<op::BufferedFile> file(new op::BufferedFile());
+        bool ok = file->open(path) &&
+                  (codecs[k] != op::FileFinisher::cmpZstd || file->setZstd(3, op::hardwareThreads()));
+        for (size_t pos = 0; ok && pos < flows.size(); pos += (1 << 16)) {
+            ok = file->append(flows.data() + pos, std::min(flows.size() - pos, (size_t) 1 << 16));
+        }
+        op::FileFinisher finisher;
+        finisher.setCompression(codecs[k], 6);
+        ok = ok && finisher.finish(std::move(file), path);
+        double writeSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        path = base + suffixes[k];
+        if (!ok) {
+            std::cerr << "ERR: can't write '" << path << "': " << finisher.errorString() << std::endl;
+            ::remove(path.c_str());
+            return 1;
+        }
+        struct stat st;
+        uint64_t size = (::stat(path.c_str(), &st) == 0 ? (uint64_t) st.st_size : 0);
+
+        start = std::chrono::steady_clock::now();
+        op::MFlowParser parser;
+        op::MFlowParser::Record rec;
+        op::Arena arena(1 << 16);
+        op::FlowEvents events;
+        size_t records = 0, requests = 0;
+        ok = parser.open(path);
+        while (ok && parser.nextRecord(rec)) {
+            // records are parsed as for conversion, each flow gives events
+            arena.clear();
+            events.clear();
+            requests += (op::collectEvents(parser.parseRecord(rec, arena), records, events) == 2);
+            ++records;
+        }
+        double readSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ::remove(path.c_str());
+        if (!ok || parser.isError() || records != FLOWS || requests != FLOWS) {
+            std::cerr << "ERR: " << names[k] << " file is read wrong: " << parser.errorString()
+                      << std::endl;
+            return 1;
+        }
+        std::cout << names[k] << ": write " << (int) (bytes / writeSecs / (1 << 20)) << " MB/s, read "
+                  << (int) (bytes / readSecs / (1 << 20)) << " MB/s, size "
+                  << (int) (size * 100 / bytes) << "%" << std::endl;
+    }
+    return 0;
+}
+
+void showUsage() {
+    std::cout << "Usage: mitmproxy2pcap-bench checksum|compression [TEMP_DIR]\n"
+              << "checksum - measure speed of checksum implementations.\n"
+              << "compression - measure speed of writing and reading of synthetic\n"
+              << "           flow file with each compression, it's written to\n"
+              << "           TEMP_DIR, $TMPDIR by default.\n";
+}
+
+// entry point of benchmarks
+int main(int argc, char** argv) {
+    if (argc == 2 && !::strcmp(argv[1], "checksum")) {
+        return benchChecksum();
+    }
+    if ((argc == 2 || argc == 3) && !::strcmp(argv[1], "compression")) {
+        return benchCompression(argc == 3 ? argv[2] : "");
+    }
+    showUsage();
+    return (argc == 1 || (argc == 2 && !::strcmp(argv[1], "--help"))) ? 0 : 1;
+}
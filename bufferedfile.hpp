@@ -0,0 +1,434 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <stdint.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef _MSC_VER
+typedef intptr_t ssize_t;
+#endif
+
+namespace op {
+
+// piece of data written by gather output
+struct Slice {
+    const void * mData;
+    size_t mLength;
+};
+
+/*
+ * Output file with big user space buffer. Data is gathered in buffer and
+ * written by large write() calls; chunks bigger than half of buffer are
+ * written directly together with buffered data by one writev().
+ * appendv() writes list of slices the same way, so big ones go from
+ * their memory to file without copying.
+ *
+ * With setZstd() buffer is compressed to zstd frame by each write, frame
+ * is ended by close(); all data is copied to buffer then.
+ *
+ * Path "-" is standard output, it's flushed but not closed by close().
+ */
+
+class BufferedFile {
+public:
+    BufferedFile()
+        : mFd(-1)
+        , mOwnFd(false)
+        , mUsed(0)
+        , mWritten(0)
+        , mOnDisk(0)
+        , mPreallocated(0)
+#ifdef HAVE_ZSTD
+        , mZstd(nullptr)
+#endif
+    {}
+
+    ~BufferedFile() {
+        close();
+    }
+
+    // preallocate - bytes to reserve on disk for output, 0 - don't reserve;
+    // append - data is added to existing file, bytesWritten() counts new ones
+    bool open(const std::string & path, size_t bufferSize = 8 << 20, uint64_t preallocate = 0,
+              bool append = false) {
+        close();
+        mError.clear();
+        mOwnFd = !isStdout(path);
+        if (!mOwnFd) {
+#ifdef WIN32
+            ::_setmode(1, _O_BINARY);
+#endif
+            mFd = 1;
+            preallocate = 0;
+        } else {
+#ifdef WIN32
+            mFd = ::_open(path.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY |
+                          (append ? _O_APPEND : _O_TRUNC), _S_IREAD | _S_IWRITE);
+#else
+            mFd = ::open(path.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+#endif
+        }
+        if (mFd < 0) {
+            mError = "can't open '" + path + "' for writing: " + ::strerror(errno);
+            return false;
+        }
+        mBuffer.resize(bufferSize < 4096 ? 4096 : bufferSize);
+        mUsed = 0;
+        mWritten = 0;
+        mOnDisk = 0;
+        mPreallocated = 0;
+#ifdef __linux__
+        if (preallocate != 0 && !append && ::posix_fallocate(mFd, 0, (off_t) preallocate) == 0) {
+            mPreallocated = preallocate;
+        }
+#else
+        (void) preallocate;
+#endif
+        return true;
+    }
+
+    bool isOpen() const {
+        return mFd >= 0;
+    }
+
+    static bool isStdout(const std::string & path) {
+        return path == "-";
+    }
+
+    // compress data written after open(), level 1 (fast) .. 22 (small);
+    // workers - threads of compressor, 0 - it's done by caller
+    bool setZstd(int level, unsigned workers = 0) {
+#ifdef HAVE_ZSTD
+        if (mZstd == nullptr)
+            mZstd = ZSTD_createCCtx();
+        if (mZstd == nullptr || ZSTD_isError(ZSTD_CCtx_setParameter(mZstd, ZSTD_c_compressionLevel, level))) {
+            mError = "can't set up zstd compression.";
+            return false;
+        }
+        // libzstd built without threads refuses workers, data is compressed anyway
+        ZSTD_CCtx_setParameter(mZstd, ZSTD_c_nbWorkers, (int) workers);
+        mCompressed.resize(ZSTD_CStreamOutSize());
+        return true;
+#else
+        (void) level;
+        (void) workers;
+        mError = "zstd isn't supported, built without libzstd.";
+        return false;
+#endif
+    }
+
+    bool append(const void * data, size_t len) {
+        if (isCompressed())
+            return appendCopy(data, len);
+        if (len > mBuffer.size() / 2) {
+            return writeThrough(data, len);
+        }
+        if (mUsed + len > mBuffer.size() && !flush())
+            return false;
+        memcpy(&mBuffer[mUsed], data, len);
+        mUsed += len;
+        return true;
+    }
+
+    bool appendv(const Slice * slices, size_t count) {
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total += slices[i].mLength;
+        }
+        if (total <= mBuffer.size() / 2 || isCompressed()) {
+            for (size_t i = 0; i < count; ++i) {
+                if (!append(slices[i].mData, slices[i].mLength))
+                    return false;
+            }
+            return true;
+        }
+        return writeGather(slices, count);
+    }
+
+    bool flush() {
+        if (isCompressed())
+            return compress(flushBuffer);
+        const char * p = mBuffer.data();
+        size_t left = mUsed;
+        while (left > 0) {
+            ssize_t rv = sysWrite(p, left);
+            if (rv < 0) {
+                if (errno == EINTR) continue;
+                mError = std::string("write() failed: ") + ::strerror(errno);
+                return false;
+            }
+            p += rv;
+            left -= rv;
+            mWritten += rv;
+        }
+        mUsed = 0;
+        return true;
+    }
+
+    // write buffered data so reader of file gets all of it now, zstd
+    // block is ended for it
+    bool sync() {
+        return isCompressed() ? compress(flushBlock) : flush();
+    }
+
+    bool close() {
+        if (mFd < 0)
+            return true;
+        bool ok = (isCompressed() ? compress(flushFrame) : flush());
+#ifdef HAVE_ZSTD
+        if (mZstd != nullptr) ZSTD_freeCCtx(mZstd);
+        mZstd = nullptr;
+#endif
+#ifndef WIN32
+        // cut space reserved but not used
+        if (mPreallocated > mOnDisk && ::ftruncate(mFd, (off_t) mOnDisk) != 0)
+            ok = failed("ftruncate() failed: ");
+        if (mOwnFd && ::close(mFd) != 0)
+            ok = failed("close() failed: ");
+#else
+        if (mOwnFd && ::_close(mFd) != 0)
+            ok = failed("close() failed: ");
+#endif
+        mFd = -1;
+        std::vector<char>().swap(mBuffer);
+        return ok;
+    }
+
+    // bytes passed to file so far, buffered ones included; they are
+    // counted before compression
+    uint64_t bytesWritten() const {
+        return mWritten + mUsed;
+    }
+
+    const std::string & errorString() const {
+        return mError;
+    }
+
+private:
+    BufferedFile(const BufferedFile &);
+    BufferedFile & operator=(const BufferedFile &);
+
+    // error of system call, the first one is kept
+    bool failed(const char * what) {
+        if (mError.empty())
+            mError = what + std::string(::strerror(errno));
+        return false;
+    }
+
+    // how much of compressed data is written
+    enum FLUSH {
+        flushBuffer,    // compressor could keep part of it
+        flushBlock,     // all of it, frame goes on
+        flushFrame      // all of it, frame is ended
+    };
+
+    ssize_t sysWrite(const void * data, size_t len) {
+#ifdef WIN32
+        ssize_t rv = ::_write(mFd, data, (unsigned) len);
+#else
+        ssize_t rv = ::write(mFd, data, len);
+#endif
+        if (rv > 0) mOnDisk += rv;
+        return rv;
+    }
+
+    bool isCompressed() const {
+#ifdef HAVE_ZSTD
+        return mZstd != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    // compressor takes data from buffer only
+    bool appendCopy(const void * data, size_t len) {
+        const char * p = (const char *) data;
+        while (len > 0) {
+            if (mUsed == mBuffer.size() && !flush())
+                return false;
+            size_t n = std::min(len, mBuffer.size() - mUsed);
+            memcpy(&mBuffer[mUsed], p, n);
+            mUsed += n;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    // compress buffer and write what compressor gives
+    bool compress(FLUSH how) {
+#ifdef HAVE_ZSTD
+        ZSTD_inBuffer in = { mBuffer.data(), mUsed, 0 };
+        ZSTD_EndDirective mode = (how == flushFrame ? ZSTD_e_end :
+                                  how == flushBlock ? ZSTD_e_flush : ZSTD_e_continue);
+        for (;;) {
+            ZSTD_outBuffer out = { &mCompressed[0], mCompressed.size(), 0 };
+            size_t rv = ZSTD_compressStream2(mZstd, &out, &in, mode);
+            if (ZSTD_isError(rv)) {
+                mError = std::string("zstd compression failed: ") + ZSTD_getErrorName(rv);
+                return false;
+            }
+            if (!writeAll(out.dst, out.pos, false))
+                return false;
+            if (how != flushBuffer ? rv == 0 : in.pos == in.size)
+                break;
+        }
+        mWritten += mUsed;
+        mUsed = 0;
+        return true;
+#else
+        (void) how;
+        return false;
+#endif
+    }
+
+    bool writeThrough(const void * data, size_t len) {
+#ifdef WIN32
+        return flush() && writeAll(data, len);
+#else
+        const char * p = (const char*) data;
+        while (mUsed > 0) {
+            struct iovec iov[2];
+            iov[0].iov_base = &mBuffer[0];
+            iov[0].iov_len  = mUsed;
+            iov[1].iov_base = (void*) p;
+            iov[1].iov_len  = len;
+            ssize_t rv = ::writev(mFd, iov, 2);
+            if (rv < 0) {
+                if (errno == EINTR) continue;
+                mError = std::string("writev() failed: ") + ::strerror(errno);
+                return false;
+            }
+            mWritten += rv;
+            mOnDisk += rv;
+            if ((size_t) rv < mUsed) {
+                memmove(&mBuffer[0], &mBuffer[rv], mUsed - rv);
+                mUsed -= rv;
+            } else {
+                rv -= mUsed;
+                mUsed = 0;
+                p += rv;
+                len -= rv;
+            }
+        }
+        return writeAll(p, len);
+#endif
+    }
+
+    bool writeGather(const Slice * slices, size_t count) {
+#ifdef WIN32
+        if (!flush())
+            return false;
+        for (size_t i = 0; i < count; ++i) {
+            if (!writeAll(slices[i].mData, slices[i].mLength))
+                return false;
+        }
+        return true;
+#else
+        // buffered data goes first
+        std::vector<struct iovec> iov;
+        iov.reserve(count + 1);
+        if (mUsed > 0) {
+            struct iovec v = { &mBuffer[0], mUsed };
+            iov.push_back(v);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (slices[i].mLength == 0) continue;
+            struct iovec v = { (void*) slices[i].mData, slices[i].mLength };
+            iov.push_back(v);
+        }
+        mUsed = 0;
+        const size_t MAX_IOV = 1024;
+        size_t first = 0;
+        while (first < iov.size()) {
+            size_t n = std::min(iov.size() - first, MAX_IOV);
+            ssize_t rv = ::writev(mFd, &iov[first], (int) n);
+            if (rv < 0) {
+                if (errno == EINTR) continue;
+                mError = std::string("writev() failed: ") + ::strerror(errno);
+                return false;
+            }
+            mWritten += rv;
+            mOnDisk += rv;
+            // skip written slices, rest of partially written one stays
+            while (first < iov.size() && (size_t) rv >= iov[first].iov_len) {
+                rv -= iov[first].iov_len;
+                ++first;
+            }
+            if (rv > 0) {
+                iov[first].iov_base = (char*) iov[first].iov_base + rv;
+                iov[first].iov_len -= rv;
+            }
+        }
+        return true;
+#endif
+    }
+
+    // count - data isn't compressed, so it's counted by bytesWritten()
+    bool writeAll(const void * data, size_t len, bool count = true) {
+        const char * p = (const char*) data;
+        while (len > 0) {
+            ssize_t rv = sysWrite(p, len);
+            if (rv < 0) {
+                if (errno == EINTR) continue;
+                mError = std::string("write() failed: ") + ::strerror(errno);
+                return false;
+            }
+            p += rv;
+            len -= rv;
+            if (count) mWritten += rv;
+        }
+        return true;
+    }
+
+    int mFd;
+    bool mOwnFd;                // it isn't standard output
+    std::vector<char> mBuffer;
+    size_t mUsed;
+    uint64_t mWritten;
+    uint64_t mOnDisk;           // bytes in file, compressed ones
+    uint64_t mPreallocated;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx * mZstd;
+    std::vector<char> mCompressed;
+#endif
+    std::string mError;
+}; // BufferedFile
+
+} // namespace op
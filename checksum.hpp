@@ -0,0 +1,211 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define OP_CSUM_X86 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#define OP_CSUM_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+
+namespace op {
+
+/*
+ * Internet checksum (RFC 1071). Sums are taken over native 16-bit words
+ * and stored without byte swapping, which gives the same bytes as sum
+ * in network order:
+ *     sum(data, len)          - partial sum of buffer;
+ *     checksum(sum)           - folds partial sums into checksum field.
+ * SSE2 and AVX2 versions are chosen at runtime when CPU has them.
+ */
+
+enum CHECKSUM {
+    csumNone,     // leave checksum fields zeroed
+    csumAuto,     // best one supported by CPU
+    csumScalar,
+    csumSSE2,
+    csumAVX2
+};
+
+typedef uint64_t (*SumFunc)(const void * data, size_t len);
+
+// sum of 8-bit, 16-bit and 32-bit tail of buffer
+inline uint64_t sumTail(const uint8_t * s, size_t len) {
+    uint64_t sum = 0;
+    if (len >= 4) {
+        uint32_t w;
+        memcpy(&w, s, 4);
+        sum += w;
+        s += 4; len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t w;
+        memcpy(&w, s, 2);
+        sum += w;
+        s += 2; len -= 2;
+    }
+    if (len) {
+        uint16_t w = 0;
+        memcpy(&w, s, 1);
+        sum += w;
+    }
+    return sum;
+}
+
+inline uint64_t sumScalar(const void * data, size_t len) {
+    const uint8_t * s = (const uint8_t *) data;
+    uint64_t sum = 0;
+    for (; len >= 8; len -= 8, s += 8) {
+        uint64_t w;
+        memcpy(&w, s, 8);
+        sum += (w & 0xffffffff) + (w >> 32);
+    }
+    return sum + sumTail(s, len);
+}
+
+// sum of few header bytes
+inline uint64_t sumWords(const void * data, size_t len) {
+    return sumScalar(data, len);
+}
+
+// fold partial sum into 16 bits and invert
+inline uint16_t checksum(uint64_t sum) {
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+// partial sum of data which starts at odd offset of summed packet
+inline uint64_t oddSum(uint64_t sum) {
+    uint16_t folded = (uint16_t) ~checksum(sum);
+    return (uint16_t) ((folded << 8) | (folded >> 8));
+}
+
+#ifdef OP_CSUM_X86
+inline uint64_t sumSSE2(const void * data, size_t len) {
+    const uint8_t * s = (const uint8_t *) data;
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+    while (len >= 16) {
+        // 32-bit lanes take two 16-bit words per vector without overflow
+        // for 32K vectors
+        size_t n = len / 16;
+        if (n > 16384) n = 16384;
+        __m128i acc = zero;
+        for (size_t i = 0; i < n; ++i, s += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) s);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        }
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *) lanes, acc);
+        sum += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        len -= n * 16;
+    }
+    return sum + sumScalar(s, len);
+}
+#endif
+
+#ifdef OP_CSUM_AVX2
+__attribute__((target("avx2")))
+inline uint64_t sumAVX2(const void * data, size_t len) {
+    const uint8_t * s = (const uint8_t *) data;
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+    while (len >= 32) {
+        size_t n = len / 32;
+        if (n > 16384) n = 16384;
+        __m256i acc = zero;
+        for (size_t i = 0; i < n; ++i, s += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) s);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+        }
+        uint32_t lanes[8];
+        _mm256_storeu_si256((__m256i *) lanes, acc);
+        for (int i = 0; i < 8; ++i) sum += lanes[i];
+        len -= n * 32;
+    }
+    return sum + sumScalar(s, len);
+}
+#endif
+
+inline bool checksumSupported(CHECKSUM impl) {
+    switch (impl) {
+    case csumSSE2:
+#ifdef OP_CSUM_X86
+        return true;
+#else
+        return false;
+#endif
+    case csumAVX2:
+#ifdef OP_CSUM_AVX2
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    default:
+        return true;
+    }
+}
+
+// best implementation for csumAuto
+inline CHECKSUM checksumImpl(CHECKSUM impl) {
+    if (impl != csumAuto)
+        return impl;
+    if (checksumSupported(csumAVX2)) return csumAVX2;
+    if (checksumSupported(csumSSE2)) return csumSSE2;
+    return csumScalar;
+}
+
+// function of impl or nullptr if CPU doesn't support it
+inline SumFunc sumFunc(CHECKSUM impl) {
+    impl = checksumImpl(impl);
+    if (impl == csumNone || !checksumSupported(impl))
+        return nullptr;
+#ifdef OP_CSUM_AVX2
+    if (impl == csumAVX2) return sumAVX2;
+#endif
+#ifdef OP_CSUM_X86
+    if (impl == csumSSE2) return sumSSE2;
+#endif
+    return sumScalar;
+}
+
+inline const char * checksumName(CHECKSUM impl) {
+    switch (impl) {
+    case csumNone:   return "none";
+    case csumAuto:   return "auto";
+    case csumScalar: return "scalar";
+    case csumSSE2:   return "sse2";
+    case csumAVX2:   return "avx2";
+    }
+    return "";
+}
+
+} // namespace op
@@ -0,0 +1,216 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+namespace op {
+
+/*
+ * Connection as binary tuple of address family, addresses and ports.
+ * Unused bytes are zeroed, so keys are compared and hashed as memory.
+ */
+
+struct ConnKey {
+    uint8_t mSrv[16];      // IPv4 takes first 4 bytes
+    uint8_t mCli[16];
+    uint16_t mPortSrv;
+    uint16_t mPortCli;
+    uint8_t mFamily;       // AF_INET or AF_INET6
+    uint8_t mReserved[3];
+
+    ConnKey() {
+        memset(this, 0, sizeof(*this));
+    }
+    bool operator==(const ConnKey & other) const {
+        return memcmp(this, &other, sizeof(*this)) == 0;
+    }
+    // FNV-1a over 32-bit words
+    size_t hash() const {
+        const uint32_t * w = (const uint32_t *) this;
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < sizeof(*this) / 4; ++i) {
+            h = (h ^ w[i]) * 1099511628211ULL;
+        }
+        return (size_t) (h ^ (h >> 32));
+    }
+}; // ConnKey
+
+/*
+ * Open addressing hash table of connections with linear probing and
+ * contexts stored inline. T is plain old data with:
+ *     uint32_t mPending          - events retained but not written yet;
+ *     T::Kept                    - part of context which outlives eviction;
+ *     keep(Kept &), restore(...) - save and load it.
+ *
+ * When eviction is on, connections without pending events are dropped
+ * once table holds `limit` of them; if most of connections are still
+ * pending then limit grows. Kept part of dropped connection is stored in
+ * compact table, so it goes on when connection comes back. Pointers
+ * returned by get() are valid until next get() or retain().
+ */
+
+template <class T>
+class ConnTable {
+public:
+    ConnTable()
+        : mSize(0)
+        , mKeptSize(0)
+        , mLimit(1 << 16)
+        , mEvictable(false)
+        , mEvicted(0)
+    {
+        mSlots.resize(16);
+        mKept.resize(16);
+    }
+
+    // drop connections without pending events, not more than limit are kept
+    void setEviction(bool on, size_t limit = 1 << 16) {
+        mEvictable = on;
+        mLimit = (limit < 16 ? 16 : limit);
+    }
+
+    // context of connection, new one is zeroed
+    T * get(const ConnKey & key) {
+        Slot * slot = lookup(mSlots, key);
+        if (slot->mUsed)
+            return &slot->mCtx;
+        if (mEvictable && mSize >= mLimit) {
+            evict();
+        }
+        if ((mSize + 1) * 2 > mSlots.size()) {
+            rehash(mSlots.size() * 2);
+        }
+        slot = lookup(mSlots, key);
+        slot->mUsed = true;
+        slot->mKey = key;
+        memset(&slot->mCtx, 0, sizeof(T));
+        ++mSize;
+        if (mKeptSize != 0) {
+            const KeptSlot * kept = lookup(mKept, key);
+            if (kept->mUsed)
+                slot->mCtx.restore(kept->mKept);
+        }
+        return &slot->mCtx;
+    }
+
+    // connection has event to be written
+    void retain(const ConnKey & key) {
+        ++get(key)->mPending;
+    }
+
+    // event of connection is written
+    void release(const ConnKey & key) {
+        Slot * slot = lookup(mSlots, key);
+        if (slot->mUsed && slot->mCtx.mPending > 0)
+            --slot->mCtx.mPending;
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+    uint64_t evicted() const {
+        return mEvicted;
+    }
+
+private:
+    typedef typename T::Kept Kept;
+
+    struct Slot {
+        ConnKey mKey;
+        T mCtx;
+        bool mUsed;
+        Slot() : mUsed(false)
+        {}
+    };
+    struct KeptSlot {
+        ConnKey mKey;
+        Kept mKept;
+        bool mUsed;
+        KeptSlot() : mUsed(false)
+        {}
+    };
+
+    // slot of key or empty slot where it should be put
+    template <class S>
+    static S * lookup(std::vector<S> & slots, const ConnKey & key) {
+        size_t mask = slots.size() - 1;
+        size_t i = key.hash() & mask;
+        while (slots[i].mUsed && !(slots[i].mKey == key)) {
+            i = (i + 1) & mask;
+        }
+        return &slots[i];
+    }
+
+    template <class S>
+    static void rehash(std::vector<S> & slots, size_t capacity) {
+        std::vector<S> rehashed(capacity);
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].mUsed) {
+                *lookup(rehashed, slots[i].mKey) = slots[i];
+            }
+        }
+        slots.swap(rehashed);
+    }
+    void rehash(size_t capacity) {
+        rehash(mSlots, capacity);
+    }
+
+    // kept part of connection is added or updated
+    void keep(const Slot & slot) {
+        KeptSlot * kept = lookup(mKept, slot.mKey);
+        if (!kept->mUsed) {
+            if ((mKeptSize + 1) * 2 > mKept.size()) {
+                rehash(mKept, mKept.size() * 2);
+                kept = lookup(mKept, slot.mKey);
+            }
+            kept->mUsed = true;
+            kept->mKey = slot.mKey;
+            ++mKeptSize;
+        }
+        slot.mCtx.keep(kept->mKept);
+    }
+
+    void evict() {
+        size_t before = mSize;
+        for (size_t i = 0; i < mSlots.size(); ++i) {
+            if (mSlots[i].mUsed && mSlots[i].mCtx.mPending == 0) {
+                keep(mSlots[i]);
+                mSlots[i].mUsed = false;
+                --mSize;
+            }
+        }
+        mEvicted += before - mSize;
+        rehash(mSlots.size());
+        if (mSize * 2 > mLimit) {
+            mLimit *= 2;
+        }
+    }
+
+    std::vector<Slot> mSlots;  // size is power of 2
+    size_t mSize;
+    std::vector<KeptSlot> mKept;  // of evicted connections, size is power of 2
+    size_t mKeptSize;
+    size_t mLimit;
+    bool mEvictable;
+    uint64_t mEvicted;
+}; // ConnTable
+
+} // namespace op
@@ -0,0 +1,236 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace op {
+
+/*
+ * Out-of-core sort of plain old data records. Records are collected in
+ * memory up to the budget, then sorted and spilled as runs into unnamed
+ * temporary files. merge() gives all records in order doing k-way merge
+ * of the runs, or they could be pulled one by one by next() after
+ * finish(). Open runs are limited by MAX_RUNS: when there are so many,
+ * the smaller half of them is merged into one run.
+ */
+
+template <class T>
+class ExternalSorter {
+public:
+    enum { MAX_RUNS = 64 };
+
+    ExternalSorter(size_t maxMemory, const std::string & tempDir = std::string())
+        : mTempDir(tempDir)
+        , mRunSize(maxMemory / sizeof(T))
+        , mPos(0)
+    {
+        if (mRunSize < 1024) mRunSize = 1024;
+        mRecords.reserve(std::min(mRunSize, (size_t) 1 << 16));
+    }
+
+    ~ExternalSorter() {
+        for (size_t i = 0; i < mRuns.size(); ++i) {
+            fclose(mRuns[i].mFile);
+        }
+    }
+
+    bool add(const T & rec) {
+        mRecords.push_back(rec);
+        if (mRecords.size() >= mRunSize)
+            return spill();
+        return true;
+    }
+
+    // sort added records, then they are given by next()
+    bool finish() {
+        std::sort(mRecords.begin(), mRecords.end());
+        mPos = 0;
+        if (mRuns.empty())
+            return true;
+        // what is left in memory is the last run
+        if (!mRecords.empty() && !spill())
+            return false;
+        std::vector<T>().swap(mRecords);
+        startMerge(0);
+        return mError.empty();
+    }
+
+    // next record in sorted order, false when all of them are given
+    bool next(T & rec) {
+        if (mRuns.empty()) {
+            if (mPos >= mRecords.size())
+                return false;
+            rec = mRecords[mPos++];
+            return true;
+        }
+        return nextMerged(rec);
+    }
+
+    // F is called for each record in sorted order
+    template <class F>
+    bool merge(F output) {
+        if (!finish())
+            return false;
+        T rec;
+        while (next(rec)) {
+            output(rec);
+        }
+        return mError.empty();
+    }
+
+    size_t runs() const {
+        return mRuns.size();
+    }
+    const std::string & errorString() const {
+        return mError;
+    }
+
+private:
+    struct Run {
+        FILE * mFile;
+        size_t mCount;    // of records
+        T mCurrent;
+        bool next() {
+            return fread(&mCurrent, sizeof(T), 1, mFile) == 1;
+        }
+        static bool greater(const Run * a, const Run * b) {
+            return b->mCurrent < a->mCurrent;
+        }
+        static bool larger(const Run & a, const Run & b) {
+            return a.mCount > b.mCount;
+        }
+    };
+
+    // heap of runs starting from first ordered by their current record
+    void startMerge(size_t first) {
+        mHeap.clear();
+        for (size_t i = first; i < mRuns.size(); ++i) {
+            rewind(mRuns[i].mFile);
+            if (mRuns[i].next())
+                mHeap.push_back(&mRuns[i]);
+        }
+        std::make_heap(mHeap.begin(), mHeap.end(), Run::greater);
+    }
+
+    bool nextMerged(T & rec) {
+        if (mHeap.empty())
+            return false;
+        std::pop_heap(mHeap.begin(), mHeap.end(), Run::greater);
+        Run * run = mHeap.back();
+        rec = run->mCurrent;
+        if (run->next()) {
+            std::push_heap(mHeap.begin(), mHeap.end(), Run::greater);
+        } else {
+            mHeap.pop_back();
+        }
+        return true;
+    }
+
+    // merge the smaller half of runs into one, so every record is written
+    // again only a logarithmic number of times
+    bool compact() {
+        std::sort(mRuns.begin(), mRuns.end(), Run::larger);
+        const size_t first = mRuns.size() / 2;
+        Run run;
+        run.mFile = createTemp();
+        if (run.mFile == nullptr)
+            return false;
+        run.mCount = 0;
+        setvbuf(run.mFile, nullptr, _IOFBF, 1 << 16);
+        startMerge(first);
+        T rec;
+        while (nextMerged(rec)) {
+            if (fwrite(&rec, sizeof(T), 1, run.mFile) != 1) {
+                mError = "can't write temporary file.";
+                fclose(run.mFile);
+                return false;
+            }
+            ++run.mCount;
+        }
+        fflush(run.mFile);
+        for (size_t i = first; i < mRuns.size(); ++i) {
+            fclose(mRuns[i].mFile);
+        }
+        mRuns.resize(first);
+        mRuns.push_back(run);
+        return true;
+    }
+
+    FILE * createTemp() {
+#ifdef WIN32
+        FILE * file = tmpfile();
+#else
+        std::string dir(mTempDir);
+        if (dir.empty()) {
+            const char * env = getenv("TMPDIR");
+            dir = (env != nullptr && *env) ? env : "/tmp";
+        }
+        std::string path(dir + "/mitmproxy2pcap.XXXXXX");
+        FILE * file = nullptr;
+        int fd = mkstemp(&path[0]);
+        if (fd >= 0) {
+            // file is removed on close
+            unlink(path.c_str());
+            file = fdopen(fd, "w+b");
+        }
+#endif
+        if (file == nullptr)
+            mError = "can't create temporary file for sorting.";
+        return file;
+    }
+
+    bool spill() {
+        std::sort(mRecords.begin(), mRecords.end());
+        if (mRuns.size() >= MAX_RUNS && !compact())
+            return false;
+        Run run;
+        run.mFile = createTemp();
+        if (run.mFile == nullptr)
+            return false;
+        run.mCount = mRecords.size();
+        mRuns.push_back(run);
+        setvbuf(run.mFile, nullptr, _IOFBF, 1 << 16);
+        if (fwrite(mRecords.data(), sizeof(T), mRecords.size(), run.mFile) != mRecords.size()) {
+            mError = "can't write temporary file.";
+            return false;
+        }
+        fflush(run.mFile);
+        mRecords.clear();
+        return true;
+    }
+
+    std::string mTempDir;
+    size_t mRunSize;
+    std::vector<T> mRecords;
+    size_t mPos;              // of next() in mRecords
+    std::vector<Run> mRuns;
+    std::vector<Run*> mHeap;
+    std::string mError;
+}; // ExternalSorter
+
+} // namespace op
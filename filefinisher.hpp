@@ -0,0 +1,208 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include "bufferedfile.hpp"
+#include <string>
+#include <memory>
+#include <deque>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace op {
+
+/*
+ * Closing of output files which are complete: buffered data is flushed,
+ * space reserved on disk is cut and file is compressed to <path>.gz if
+ * it's asked (zstd files are compressed by BufferedFile as they are
+ * written, only their frame is ended here). Files given by add() are
+ * finished one by one on background thread, so writer goes on with next
+ * file meanwhile; thread is started by first of them.
+ */
+
+class FileFinisher {
+public:
+    enum COMPRESSION {
+        cmpNone,
+        cmpGzip,    // needs zlib
+        cmpZstd     // needs libzstd
+    };
+
+    FileFinisher()
+        : mCompression(cmpNone)
+        , mLevel(6)
+        , mStop(false)
+    {}
+    ~FileFinisher() {
+        wait();
+    }
+
+    static bool isSupported(COMPRESSION compression) {
+        switch (compression) {
+#ifdef HAVE_ZLIB
+        case cmpGzip: return true;
+#endif
+#ifdef HAVE_ZSTD
+        case cmpZstd: return true;
+#endif
+        case cmpNone: return true;
+        default: return false;
+        }
+    }
+
+    // level - 1 (fast) .. 9 (small) for gzip
+    void setCompression(COMPRESSION compression, int level = 6) {
+        mCompression = compression;
+        mLevel = level;
+    }
+
+    // finish file on background thread
+    void add(std::unique_ptr<BufferedFile> file, const std::string & path) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.push_back(Item(file.release(), path));
+        if (!mThread.joinable()) {
+            mStop = false;
+            mThread = std::thread(&FileFinisher::run, this);
+        }
+        mReady.notify_one();
+    }
+
+    // finish file on caller's thread
+    bool finish(std::unique_ptr<BufferedFile> file, const std::string & path) {
+        std::string error;
+        if (finishFile(*file, path, error))
+            return true;
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mError.empty()) mError = error;
+        return false;
+    }
+
+    // wait until files given by add() are finished, false if some of them failed
+    bool wait() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+            mReady.notify_one();
+        }
+        if (mThread.joinable())
+            mThread.join();
+        return mError.empty();
+    }
+
+    // first error
+    std::string errorString() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mError;
+    }
+
+private:
+    FileFinisher(const FileFinisher &);
+    FileFinisher & operator=(const FileFinisher &);
+
+    typedef std::pair<BufferedFile*, std::string> Item;
+
+    // queue is drained before thread stops
+    void run() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;) {
+            mReady.wait(lock, [this] { return mStop || !mQueue.empty(); });
+            if (mQueue.empty())
+                break;
+            std::unique_ptr<BufferedFile> file(mQueue.front().first);
+            std::string path = mQueue.front().second;
+            mQueue.pop_front();
+            lock.unlock();
+            std::string error;
+            bool ok = finishFile(*file, path, error);
+            file.reset();
+            lock.lock();
+            if (!ok && mError.empty()) mError = error;
+        }
+    }
+
+    bool finishFile(BufferedFile & file, const std::string & path, std::string & error) const {
+        // error of earlier write is reported too
+        bool ok = file.close() && file.errorString().empty();
+        if (!ok) {
+            error = file.errorString();
+            return false;
+        }
+        if (mCompression == cmpGzip)
+            return gzip(path, error);
+        return true;
+    }
+
+    // replace file by <path>.gz
+    bool gzip(const std::string & path, std::string & error) const {
+#ifdef HAVE_ZLIB
+        std::string gzPath = path + ".gz";
+        FILE * in = fopen(path.c_str(), "rb");
+        if (in == nullptr) {
+            error = "can't open '" + path + "': " + ::strerror(errno);
+            return false;
+        }
+        char mode[] = "wb6";
+        mode[2] = (char) ('0' + (mLevel < 1 ? 1 : mLevel > 9 ? 9 : mLevel));
+        gzFile out = gzopen(gzPath.c_str(), mode);
+        if (out == nullptr) {
+            fclose(in);
+            error = "can't open '" + gzPath + "' for writing.";
+            return false;
+        }
+        std::vector<char> buffer(1 << 20);
+        bool ok = true;
+        size_t len;
+        while (ok && (len = fread(buffer.data(), 1, buffer.size(), in)) > 0) {
+            ok = gzwrite(out, buffer.data(), (unsigned) len) == (int) len;
+        }
+        ok = !ferror(in) && ok;
+        fclose(in);
+        ok = (gzclose(out) == Z_OK) && ok;
+        if (!ok) {
+            ::remove(gzPath.c_str());
+            error = "can't compress '" + path + "' to '" + gzPath + "'.";
+            return false;
+        }
+        ::remove(path.c_str());
+        return true;
+#else
+        error = "can't compress '" + path + "': built without zlib.";
+        return false;
+#endif
+    }
+
+    COMPRESSION mCompression;
+    int mLevel;
+    std::deque<Item> mQueue;
+    std::thread mThread;
+    mutable std::mutex mMutex;
+    std::condition_variable mReady;
+    bool mStop;
+    std::string mError;
+}; // FileFinisher
+
+} // namespace op
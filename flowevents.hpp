@@ -0,0 +1,321 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include "variant.hpp"
+#include "projection.hpp"
+#include "pcapdumper.hpp"
+#include <vector>
+#include <memory>
+#include <cstdio>
+
+namespace op {
+
+/*
+ * HTTP request or response of flow which should be written to pcap at
+ * its timestamp.
+ */
+
+struct FlowEvent {
+    int64_t mTs;                   // nanoseconds since epoch
+    uint64_t mOrder;               // flow index * 2 + direction, ties timestamps
+    VariantPtr mNodePtr;           // flow
+    bool mRequest;
+    std::shared_ptr<Arena> mArena; // keeps tree of streamed flow alive
+
+    FlowEvent()
+    {}
+    FlowEvent(int64_t ts, uint64_t flowIndex, VariantPtr ptr, bool request,
+              const std::shared_ptr<Arena> & arena = std::shared_ptr<Arena>())
+        : mTs(ts)
+        , mOrder(flowIndex * 2 + (request ? 0 : 1))
+        , mNodePtr(ptr)
+        , mRequest(request)
+        , mArena(arena)
+    {}
+
+    bool operator<(const FlowEvent & other) const {
+        if (mTs != other.mTs) return mTs < other.mTs;
+        return mOrder < other.mOrder;
+    }
+}; // FlowEvent
+
+typedef std::vector<FlowEvent> FlowEvents;
+
+/*
+ * Compact form of event for sorting out of memory, its flow is parsed
+ * again from input by offset when event is written.
+ */
+
+struct FlowEventRef {
+    int64_t mTs;       // nanoseconds
+    uint64_t mOrder;   // as in FlowEvent
+    uint64_t mOffset;  // of flow record in input
+
+    bool operator<(const FlowEventRef & other) const {
+        if (mTs != other.mTs) return mTs < other.mTs;
+        return mOrder < other.mOrder;
+    }
+    bool isRequest() const {
+        return (mOrder & 1) == 0;
+    }
+}; // FlowEventRef
+
+inline int64_t timeOf(const FlowEvent & event) {
+    return event.mTs;
+}
+
+// timestamp_start of request/response as nanoseconds, it's decoded once
+// by parser; flows with timestamps written as strings are handled too
+inline bool eventTime(VariantPtr msg, int64_t & ts) {
+    if (msg == nullptr || !msg->isMap())
+        return false;
+    VariantPtr value = msg->asMap()["timestamp_start"];
+    if (value == nullptr)
+        return false;
+    if (value->isString()) {
+        StringRef str = value->asString();
+        return parseNanos(str.begin(), str.end(), ts);
+    }
+    return value->asNanos(ts);
+}
+
+// keys of flow read by functions below, parser could skip the rest
+// (certificates, websocket messages, metadata etc.)
+inline const Projection & eventProjection() {
+    static const char * const PATHS[] = {
+        "type", "id", "request", "response",
+        "server_conn.ip_address", "server_conn.source_address"
+    };
+    static const Projection projection(PATHS, sizeof(PATHS) / sizeof(PATHS[0]));
+    return projection;
+}
+
+/*
+ * Append request and response events of flow to events. Flows of other
+ * types than http and responses which never came are skipped.
+ */
+
+inline size_t collectEvents(VariantPtr flow, uint64_t flowIndex, FlowEvents & events,
+                            const std::shared_ptr<Arena> & arena = std::shared_ptr<Arena>()) {
+    if (flow == nullptr || !flow->isMap())
+        return 0;
+    const KeyValueMap & obj = flow->asMap();
+    VariantPtr type = obj["type"];
+    if (type == nullptr || type->asString().compare("http") != 0) {
+        std::cerr << "WARN: ignored flow with type '"
+                  << (type != nullptr ? type->asString() : StringRef()) << "'" << std::endl;
+        return 0;
+    }
+
+    size_t count = 0;
+    int64_t ts;
+    VariantPtr req = obj["request"];
+    if (eventTime(req, ts)) {
+        events.push_back(FlowEvent(ts, flowIndex, flow, true, arena));
+        ++count;
+    }
+    VariantPtr resp = obj["response"];
+    if (eventTime(resp, ts)) {
+        events.push_back(FlowEvent(ts, flowIndex, flow, false, arena));
+        ++count;
+    }
+    return count;
+}
+
+// port given as integer or, by older flows, as string
+inline u_int16_t parsePort(VariantPtr value) {
+    if (value->isInt())
+        return (u_int16_t) value->asInt();
+    u_int16_t port = 0;
+    StringRef str = value->asString();
+    for (const char * p = str.begin(); p != str.end() && *p >= '0' && *p <= '9'; ++p) {
+        port = (u_int16_t) (port * 10 + (*p - '0'));
+    }
+    return port;
+}
+
+// ip:port of server and client of flow
+inline void flowAddrs(VariantPtr flow, StringRef & srv, u_int16_t & srvPort,
+                      StringRef & cli, u_int16_t & cliPort) {
+    const KeyValueMap & obj = flow->asMap();
+    const KeyValueMap & server_conn = obj["server_conn"]->asMap();
+    const ValuesVector * addrSrv;
+    const ValuesVector * addrCli;
+    if (server_conn["ip_address"]->isMap()) {
+        // old versions
+        addrSrv = &server_conn["ip_address"]->asMap()["address"]->asVector();
+        addrCli = &server_conn["source_address"]->asMap()["address"]->asVector();
+    } else {
+        // new version of flow
+        addrSrv = &server_conn["ip_address"]->asVector();
+        addrCli = &server_conn["source_address"]->asVector();
+    }
+    assert(addrSrv->size() >= 2);
+    assert(addrCli->size() >= 2);
+    srv = (*addrSrv)[0]->asString();
+    srvPort = parsePort((*addrSrv)[1]);
+    cli = (*addrCli)[0]->asString();
+    cliPort = parsePort((*addrCli)[1]);
+}
+
+inline void eventAddrs(const FlowEvent & event, StringRef & srv, u_int16_t & srvPort,
+                       StringRef & cli, u_int16_t & cliPort) {
+    flowAddrs(event.mNodePtr, srv, srvPort, cli, cliPort);
+}
+
+// binary key of event's connection
+inline bool eventConn(PCapDumper & dumper, const FlowEvent & event, ConnKey & key) {
+    StringRef srv, cli;
+    u_int16_t srvPort, cliPort;
+    eventAddrs(event, srv, srvPort, cli, cliPort);
+    return dumper.connKey(srv.data(), srv.size(), srvPort,
+                          cli.data(), cli.size(), cliPort, key);
+}
+
+// set addresses and connection of event in dumper, event without them
+// is counted by dumper as skipped
+inline bool setEventAddrs(PCapDumper & dumper, const FlowEvent & event) {
+    ConnKey key;
+    if (!eventConn(dumper, event, key)) {
+        dumper.skip();
+        return false;
+    }
+    dumper.setConnection(key);
+    return true;
+}
+
+// append server and client hosts of event to hosts
+inline void eventHosts(const FlowEvent & event, std::vector<std::string> & hosts) {
+    StringRef srv, cli;
+    u_int16_t srvPort, cliPort;
+    eventAddrs(event, srv, srvPort, cli, cliPort);
+    hosts.push_back(srv.str());
+    hosts.push_back(cli.str());
+}
+
+/*
+ * Rebuild HTTP request or response of event. Text is given by pieces
+ * to out(const StringRef &), so it could be measured or collected.
+ */
+
+template <class Sink>
+void rebuildHttp(const FlowEvent & event, Sink & out) {
+    const KeyValueMap & obj = event.mNodePtr->asMap();
+    if (event.mRequest == true) {
+        const KeyValueMap & req = obj["request"]->asMap();
+        out(req["method"]->asString()); out(" ");
+        out(req["path"]->asString()); out(" ");
+        out(req["http_version"]->asString()); out("\r\n");
+        {
+            const ValuesVector & h = req["headers"]->asVector();
+            for (unsigned i = 0; i < h.size(); ++i) {
+                const ValuesVector & hh = h[i]->asVector();
+                assert(hh.size() >= 2);
+                out(hh[0]->asString()); out(": ");
+                out(hh[1]->asString()); out("\r\n");
+            }
+        }
+        out("\r\n");
+        out(req["content"]->asString());
+    } else {
+        const KeyValueMap & resp = obj["response"]->asMap();
+        out(resp["http_version"]->asString()); out(" ");
+        out(resp["status_code"]->asString()); out(" ");
+        out(resp["reason"]->asString()); out("\r\n");
+        {
+            const ValuesVector & h = resp["headers"]->asVector();
+            for (unsigned i = 0; i < h.size(); ++i) {
+                const ValuesVector & hh = h[i]->asVector();
+                assert(hh.size() >= 2);
+                out(hh[0]->asString()); out(": ");
+                out(hh[1]->asString()); out("\r\n");
+            }
+        }
+        out("\r\n");
+        out(resp["content"]->asString());
+    }
+}
+
+struct HttpLength {
+    size_t mLength;
+    HttpLength() : mLength(0)
+    {}
+    void operator()(const StringRef & str) {
+        mLength += str.size();
+    }
+};
+
+struct HttpText {
+    std::string & mText;
+    void operator()(const StringRef & str) {
+        mText.append(str.data(), str.size());
+    }
+};
+
+// pieces refer to flow data and string literals, empty ones are skipped
+struct HttpPieces {
+    std::vector<Slice> & mPieces;
+    size_t mLength;
+    void operator()(const StringRef & str) {
+        if (str.empty()) return;
+        Slice piece = { str.data(), str.size() };
+        mPieces.push_back(piece);
+        mLength += str.size();
+    }
+};
+
+inline size_t httpLength(const FlowEvent & event) {
+    HttpLength length;
+    rebuildHttp(event, length);
+    return length.mLength;
+}
+
+inline void httpText(const FlowEvent & event, std::string & text) {
+    HttpText out = { text };
+    text.clear();
+    rebuildHttp(event, out);
+}
+
+// HTTP message as gather list without copying its data, returns its length
+inline size_t httpPieces(const FlowEvent & event, std::vector<Slice> & pieces) {
+    HttpPieces out = { pieces, 0 };
+    pieces.clear();
+    rebuildHttp(event, out);
+    return out.mLength;
+}
+
+// id of flow of event, it's written into pcapng comments only
+inline std::string flowId(const PCapDumper & dumper, const FlowEvent & event) {
+    if (dumper.format() != PCapDumper::fmtPcapNG)
+        return std::string();
+    VariantPtr id = event.mNodePtr->asMap()["id"];
+    return (id != nullptr ? id->asString().str() : std::string());
+}
+
+// rebuild HTTP request or response of event and write it to pcap
+inline void dumpEvent(PCapDumper & dumper, const FlowEvent & event) {
+    if (!setEventAddrs(dumper, event))
+        return;
+    std::vector<Slice> pieces;
+    size_t len = httpPieces(event, pieces);
+    dumper.dump(pieces.data(), pieces.size(), len, event.mTs, event.mRequest,
+                flowId(dumper, event));
+} // dumpEvent
+
+} // namespace op
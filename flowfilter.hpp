@@ -0,0 +1,262 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include "mflow.hpp"
+#include "flowevents.hpp"
+#include "flowindex.hpp"
+#include "numbers.hpp"
+#include <string>
+#include <vector>
+#include <utility>
+#include <cctype>
+#include <stdint.h>
+
+namespace op {
+
+/*
+ * Selection of flows by type, host (of request or server address),
+ * request method, response status and time range. Time of flow is start
+ * of its request, or of response when request has none. Values given
+ * for one criterion are alternatives, all criteria must match.
+ *
+ * Parser checks filter on small tree of projection(), so flows which
+ * don't match are never parsed whole and get no events.
+ */
+
+class FlowFilter : public RecordFilter {
+public:
+    FlowFilter()
+        : mSince(INT64_MIN)
+        , mUntil(INT64_MAX)
+    {
+        static const char * const PATHS[] = {
+            "type", "request.timestamp_start", "request.host", "request.method",
+            "response.timestamp_start", "response.status_code", "server_conn.ip_address"
+        };
+        for (size_t i = 0; i < sizeof(PATHS) / sizeof(PATHS[0]); ++i) {
+            mProjection.add(PATHS[i]);
+        }
+    }
+
+    bool empty() const {
+        return mTypes.empty() && !needsRecord() && !hasTime();
+    }
+
+    void addType(const std::string & type) {
+        mTypes.push_back(type);
+    }
+    void addHost(const std::string & host) {
+        mHosts.push_back(host);
+    }
+    void addMethod(const std::string & method) {
+        mMethods.push_back(method);
+    }
+    // "404" or class of codes "4xx"
+    bool addStatus(const std::string & status) {
+        int64_t code;
+        if (status.size() == 3 && isdigit((unsigned char) status[0]) &&
+            (status.compare(1, 2, "xx") == 0 || status.compare(1, 2, "XX") == 0)) {
+            int lo = (status[0] - '0') * 100;
+            mStatus.push_back(std::make_pair(lo, lo + 99));
+        } else if (parseInt(status.data(), status.data() + status.size(), code) &&
+                   code >= 100 && code <= 999) {
+            mStatus.push_back(std::make_pair((int) code, (int) code));
+        } else {
+            return false;
+        }
+        return true;
+    }
+    // flows in [since, until), nanoseconds
+    void setSince(int64_t ns) {
+        mSince = ns;
+    }
+    void setUntil(int64_t ns) {
+        mUntil = ns;
+    }
+
+    virtual const Projection & projection() const {
+        return mProjection;
+    }
+
+    virtual bool accept(VariantPtr head) const {
+        if (head == nullptr || !head->isMap())
+            return true;  // it's not a flow, conversion skips it
+        const KeyValueMap & obj = head->asMap();
+        if (!mTypes.empty() && !oneOf(mTypes, text(obj["type"])))
+            return false;
+        VariantPtr req = obj["request"];
+        VariantPtr resp = obj["response"];
+        if (hasTime()) {
+            int64_t ts;
+            if (!eventTime(req, ts) && !eventTime(resp, ts))
+                return false;
+            if (ts < mSince || ts >= mUntil)
+                return false;
+        }
+        if (!mMethods.empty() && !oneOf(mMethods, field(req, "method")))
+            return false;
+        if (!mStatus.empty() && !matchStatus(resp))
+            return false;
+        if (!mHosts.empty() && !oneOf(mHosts, field(req, "host")) &&
+            !oneOf(mHosts, serverHost(obj)))
+            return false;
+        return true;
+    }
+
+    // entry of index could pass filter, criteria which index doesn't know
+    // are checked by accept() when needsRecord()
+    bool acceptEntry(const FlowIndex & index, const IndexEntry & e) const {
+        if (e.mType == FlowIndex::NONE)
+            return true;
+        if (!mTypes.empty() && !oneOf(mTypes, index.string(e.mType)))
+            return false;
+        if (hasTime()) {
+            if ((e.mFlags & (FlowIndex::HAS_REQUEST | FlowIndex::HAS_RESPONSE)) == 0)
+                return false;
+            int64_t ts = (e.mFlags & FlowIndex::HAS_REQUEST) ? e.mReqTs : e.mRespTs;
+            if (ts < mSince || ts >= mUntil)
+                return false;
+        }
+        return true;
+    }
+    bool needsRecord() const {
+        return !mHosts.empty() || !mMethods.empty() || !mStatus.empty();
+    }
+
+    // "1539083574.5" seconds since epoch or UTC date and time
+    // "2018-10-09", "2018-10-09T11:26", "2018-10-09 11:26:14.5Z"
+    static bool parseTime(const std::string & str, int64_t & ns) {
+        const char * p = str.c_str();
+        const char * end = p + str.size();
+        if (parseNanos(p, end, ns))
+            return true;
+        if (p != end && end[-1] == 'Z') --end;
+        int64_t year, month, day, hour = 0, minute = 0, sec = 0;
+        if (!number(p, end, '-', year) || !number(p, end, '-', month) ||
+            !number(p, end, 0, day) || month < 1 || month > 12 || day < 1 || day > 31)
+            return false;
+        if (p != end) {
+            if (*p != 'T' && *p != ' ')
+                return false;
+            ++p;
+            if (!number(p, end, ':', hour) || !number(p, end, 0, minute))
+                return false;
+            if (p != end && (*p != ':' || !parseNanos(p + 1, end, sec)))
+                return false;
+        }
+        int64_t days = daysFromCivil(year, month, day);
+        ns = ((days * 24 + hour) * 60 + minute) * 60 * 1000000000LL + sec;
+        return true;
+    }
+
+private:
+    bool hasTime() const {
+        return mSince != INT64_MIN || mUntil != INT64_MAX;
+    }
+
+    static StringRef text(VariantPtr value) {
+        return (value != nullptr && !value->isMap() && !value->isRepeated())
+               ? value->asString() : StringRef();
+    }
+    static StringRef field(VariantPtr msg, const char * key) {
+        return (msg != nullptr && msg->isMap()) ? text(msg->asMap()[key]) : StringRef();
+    }
+
+    // address of server as in flowAddrs(), old and new flow versions
+    static StringRef serverHost(const KeyValueMap & obj) {
+        VariantPtr conn = obj["server_conn"];
+        if (conn == nullptr || !conn->isMap())
+            return StringRef();
+        VariantPtr addr = conn->asMap()["ip_address"];
+        if (addr != nullptr && addr->isMap())
+            addr = addr->asMap()["address"];
+        if (addr == nullptr || !addr->isRepeated() || addr->asVector().empty())
+            return StringRef();
+        return text(addr->asVector()[0]);
+    }
+
+    // case of letters is ignored
+    static bool oneOf(const std::vector<std::string> & values, const StringRef & str) {
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (values[i].size() != str.size())
+                continue;
+            size_t j = 0;
+            while (j < str.size() && tolower((unsigned char) values[i][j]) ==
+                                     tolower((unsigned char) str[j])) ++j;
+            if (j == str.size())
+                return true;
+        }
+        return false;
+    }
+
+    bool matchStatus(VariantPtr resp) const {
+        if (resp == nullptr || !resp->isMap())
+            return false;
+        VariantPtr status = resp->asMap()["status_code"];
+        int64_t code;
+        if (status == nullptr)
+            return false;
+        if (status->isInt()) {
+            code = status->asInt();
+        } else {
+            StringRef str = text(status);
+            if (!parseInt(str.begin(), str.end(), code))
+                return false;
+        }
+        for (size_t i = 0; i < mStatus.size(); ++i) {
+            if (code >= mStatus[i].first && code <= mStatus[i].second)
+                return true;
+        }
+        return false;
+    }
+
+    // digits at p followed by separator sep (if it's not 0)
+    static bool number(const char *& p, const char * end, char sep, int64_t & value) {
+        const char * digits = p;
+        while (p != end && isdigit((unsigned char) *p)) ++p;
+        if (!parseInt(digits, p, value))
+            return false;
+        if (sep != 0) {
+            if (p == end || *p != sep)
+                return false;
+            ++p;
+        }
+        return true;
+    }
+
+    // days since 1970-01-01 of proleptic Gregorian date
+    static int64_t daysFromCivil(int64_t y, int64_t m, int64_t d) {
+        y -= (m <= 2);
+        int64_t era = (y >= 0 ? y : y - 399) / 400;
+        int64_t yoe = y - era * 400;
+        int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + doe - 719468;
+    }
+
+    Projection mProjection;
+    std::vector<std::string> mTypes;
+    std::vector<std::string> mHosts;
+    std::vector<std::string> mMethods;
+    std::vector<std::pair<int, int> > mStatus;
+    int64_t mSince;
+    int64_t mUntil;
+}; // FlowFilter
+
+} // namespace op
@@ -0,0 +1,286 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include "mflow.hpp"
+#include "flowevents.hpp"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+namespace op {
+
+/*
+ * What conversion needs to know about top-level record of flow file
+ * without parsing it. Strings (type and hosts) are indexes in string
+ * table of FlowIndex.
+ */
+
+struct IndexEntry {
+    uint64_t mOffset;      // of record in input
+    int64_t mReqTs;        // nanoseconds, valid with HAS_REQUEST
+    int64_t mRespTs;       // nanoseconds, valid with HAS_RESPONSE
+    uint32_t mType;        // NONE for records which are not maps
+    uint32_t mSrv;         // NONE for flows without events or not http
+    uint32_t mCli;
+    uint16_t mSrvPort;
+    uint16_t mCliPort;
+    uint8_t mFlags;
+    uint8_t mPrefix;       // bytes of length and ':' before data of record
+    uint8_t mReserved[2];
+    uint32_t mLength;      // of data of record
+
+    IndexEntry() {
+        memset(this, 0, sizeof(*this));
+    }
+}; // IndexEntry
+
+/*
+ * Sidecar index `<input>.mfidx` of flow file. It holds entry per record
+ * in order of input and is valid while size, modification time and hash
+ * of head and tail of input are the same as when index was built.
+ *
+ * File is header, array of entries and strings each prefixed by its
+ * 32-bit length; numbers are in host byte order.
+ */
+
+class FlowIndex {
+public:
+    enum {
+        NONE = 0xFFFFFFFF,
+        HAS_REQUEST = 1,
+        HAS_RESPONSE = 2
+    };
+
+    static std::string pathOf(const std::string & inPath) {
+        return inPath + ".mfidx";
+    }
+
+    void clear() {
+        mEntries.clear();
+        mStrings.clear();
+        mIds.clear();
+    }
+
+    // entry of record parsed with eventProjection()
+    void add(const MFlowParser::Record & rec, VariantPtr flow) {
+        IndexEntry e;
+        e.mOffset = rec.mOffset;
+        e.mPrefix = (uint8_t) rec.mPrefix;
+        e.mLength = (uint32_t) rec.mLength;
+        e.mType = e.mSrv = e.mCli = NONE;
+        if (flow != nullptr && flow->isMap()) {
+            const KeyValueMap & obj = flow->asMap();
+            VariantPtr type = obj["type"];
+            e.mType = intern(type != nullptr ? type->asString() : StringRef());
+            if (eventTime(obj["request"], e.mReqTs))
+                e.mFlags |= HAS_REQUEST;
+            if (eventTime(obj["response"], e.mRespTs))
+                e.mFlags |= HAS_RESPONSE;
+            if (e.mFlags != 0 && string(e.mType) == "http") {
+                StringRef srv, cli;
+                flowAddrs(flow, srv, e.mSrvPort, cli, e.mCliPort);
+                e.mSrv = intern(srv);
+                e.mCli = intern(cli);
+            }
+        }
+        mEntries.push_back(e);
+    }
+
+    // parse all records of opened input
+    void build(MFlowParser & parser) {
+        clear();
+        Arena arena(1 << 16);
+        MFlowParser::Record rec;
+        while (parser.nextRecord(rec)) {
+            arena.clear();
+            add(rec, parser.parseRecord(rec, arena));
+        }
+    }
+
+    size_t size() const {
+        return mEntries.size();
+    }
+    const IndexEntry & operator[](size_t idx) const {
+        return mEntries[idx];
+    }
+    StringRef string(uint32_t id) const {
+        return (id == NONE ? StringRef() : StringRef(mStrings[id]));
+    }
+
+    // read index of input, false if there is none or it's stale
+    bool load(const std::string & inPath) {
+        clear();
+        Header expected, header;
+        if (!stamp(inPath, expected))
+            return false;
+        FILE * file = fopen(pathOf(inPath).c_str(), "rb");
+        if (file == nullptr)
+            return false;
+        // record takes 3 bytes at least, so broken count isn't allocated
+        bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+                  !memcmp(&header, &expected, offsetof(Header, mEntries)) &&
+                  header.mEntries <= header.mInputSize / 3 &&
+                  header.mStrings <= header.mEntries * 3;
+        if (ok) {
+            mEntries.resize((size_t) header.mEntries);
+            ok = mEntries.empty() ||
+                 fread(&mEntries[0], sizeof(IndexEntry), mEntries.size(), file) == mEntries.size();
+        }
+        for (uint64_t i = 0; ok && i < header.mStrings; ++i) {
+            uint32_t len;
+            ok = fread(&len, sizeof(len), 1, file) == 1;
+            if (ok) {
+                std::string str(len, '\0');
+                ok = len == 0 || fread(&str[0], 1, len, file) == len;
+                mStrings.push_back(str);
+            }
+        }
+        fclose(file);
+        ok = ok && isValid(header.mInputSize);
+        if (!ok) clear();
+        return ok;
+    }
+
+    // write index next to input, it replaces old one when it's complete
+    bool save(const std::string & inPath) {
+        Header header;
+        if (!stamp(inPath, header)) {
+            mError = "can't get size and hash of '" + inPath + "'.";
+            return false;
+        }
+        header.mEntries = mEntries.size();
+        header.mStrings = mStrings.size();
+        std::string path = pathOf(inPath), temp = path + ".tmp";
+        FILE * file = fopen(temp.c_str(), "wb");
+        if (file == nullptr) {
+            mError = "can't create '" + temp + "'.";
+            return false;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  (mEntries.empty() ||
+                   fwrite(&mEntries[0], sizeof(IndexEntry), mEntries.size(), file) == mEntries.size());
+        for (size_t i = 0; ok && i < mStrings.size(); ++i) {
+            uint32_t len = (uint32_t) mStrings[i].size();
+            ok = fwrite(&len, sizeof(len), 1, file) == 1 &&
+                 fwrite(mStrings[i].data(), 1, len, file) == len;
+        }
+        ok = (fclose(file) == 0) && ok;
+        ::remove(path.c_str());
+        if (!ok || ::rename(temp.c_str(), path.c_str()) != 0) {
+            ::remove(temp.c_str());
+            mError = "can't write '" + path + "'.";
+            return false;
+        }
+        return true;
+    }
+
+    const std::string & errorString() const {
+        return mError;
+    }
+
+private:
+    struct Header {
+        char mMagic[8];
+        uint32_t mVersion;
+        uint32_t mEntrySize;
+        uint64_t mInputSize;
+        int64_t mInputTime;
+        uint64_t mInputHash;
+        uint64_t mEntries;     // fields above are compared on load
+        uint64_t mStrings;
+
+        Header() {
+            memset(this, 0, sizeof(*this));
+            memcpy(mMagic, "MFIDX\0\0\0", 8);
+            mVersion = 2;
+            mEntrySize = sizeof(IndexEntry);
+        }
+    };
+
+    // size, modification time and FNV-1a of first and last 64K of input
+    static bool stamp(const std::string & inPath, Header & header) {
+        struct stat st;
+        if (::stat(inPath.c_str(), &st) != 0)
+            return false;
+        header.mInputSize = (uint64_t) st.st_size;
+        header.mInputTime = (int64_t) st.st_mtime;
+
+        const uint64_t CHUNK = 1 << 16;
+        std::ifstream is(inPath.c_str(), std::ifstream::binary);
+        if (!is.is_open())
+            return false;
+        std::vector<char> buffer((size_t) std::min(header.mInputSize, 2 * CHUNK));
+        if (header.mInputSize <= 2 * CHUNK) {
+            is.read(buffer.data(), buffer.size());
+        } else {
+            is.read(buffer.data(), CHUNK);
+            is.seekg((std::streamoff) (header.mInputSize - CHUNK));
+            is.read(buffer.data() + CHUNK, CHUNK);
+        }
+        if (!is)
+            return false;
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < buffer.size(); ++i) {
+            h = (h ^ (unsigned char) buffer[i]) * 1099511628211ULL;
+        }
+        header.mInputHash = h;
+        return true;
+    }
+
+    // entries refer to strings and records which exist, so broken index
+    // with right stamp isn't used
+    bool isValid(uint64_t inputSize) const {
+        for (size_t i = 0; i < mEntries.size(); ++i) {
+            const IndexEntry & e = mEntries[i];
+            if (!validId(e.mType) || !validId(e.mSrv) || !validId(e.mCli) ||
+                e.mOffset + e.mPrefix + e.mLength >= inputSize)
+                return false;
+        }
+        return true;
+    }
+    bool validId(uint32_t id) const {
+        return id == NONE || id < mStrings.size();
+    }
+
+    uint32_t intern(const StringRef & str) {
+        std::string key = str.str();
+        std::unordered_map<std::string, uint32_t>::const_iterator it = mIds.find(key);
+        if (it != mIds.end())
+            return it->second;
+        uint32_t id = (uint32_t) mStrings.size();
+        mStrings.push_back(key);
+        mIds[key] = id;
+        return id;
+    }
+
+    std::vector<IndexEntry> mEntries;
+    std::vector<std::string> mStrings;
+    std::unordered_map<std::string, uint32_t> mIds;
+    std::string mError;
+}; // FlowIndex
+
+} // namespace op
@@ -0,0 +1,405 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#ifdef WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/types.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace op {
+
+/*
+ * Told by InputBuffer that everything available so far is read, before
+ * it waits for more; reader could write out what it holds then.
+ */
+
+class InputIdle {
+public:
+    virtual ~InputIdle() {}
+    // false stops reading, input ends there
+    virtual bool idle() = 0;
+};
+
+/*
+ * Stream buffer of input file which is read by large chunks. Input
+ * compressed by gzip or zstd is recognized by its magic and decompressed
+ * on the fly, so it's never written to disk; concatenated gzip members
+ * and zstd frames are read as one stream. Path "-" is standard input.
+ */
+
+class InputBuffer : public std::streambuf {
+public:
+    enum CODEC {
+        codecNone,
+        codecGzip,  // needs zlib
+        codecZstd   // needs libzstd
+    };
+
+    InputBuffer()
+        : mFd(-1)
+        , mOwnFd(false)
+        , mIdle(nullptr)
+        , mFollow(false)
+        , mCodec(codecNone)
+        , mRawPos(0)
+        , mRawLen(0)
+        , mEof(false)
+        , mBoundary(false)
+#ifdef HAVE_ZSTD
+        , mZstd(nullptr)
+#endif
+    {
+#ifdef HAVE_ZLIB
+        memset(&mZlib, 0, sizeof(mZlib));
+        mZlibReady = false;
+#endif
+    }
+    ~InputBuffer() {
+        close();
+    }
+
+    // codec of data beginning with p
+    static CODEC detect(const char * p, size_t len) {
+        const unsigned char * u = (const unsigned char *) p;
+        if (len >= 2 && u[0] == 0x1f && u[1] == 0x8b)
+            return codecGzip;
+        if (len >= 4 && u[0] == 0x28 && u[1] == 0xb5 && u[2] == 0x2f && u[3] == 0xfd)
+            return codecZstd;
+        return codecNone;
+    }
+
+    static bool isSupported(CODEC codec) {
+        switch (codec) {
+#ifdef HAVE_ZLIB
+        case codecGzip: return true;
+#endif
+#ifdef HAVE_ZSTD
+        case codecZstd: return true;
+#endif
+        case codecNone: return true;
+        default: return false;
+        }
+    }
+
+    static const char * codecName(CODEC codec) {
+        switch (codec) {
+        case codecGzip: return "gzip";
+        case codecZstd: return "zstd";
+        default: return "none";
+        }
+    }
+
+    /*
+     * idle is called when input has no data ready and then every IDLE_MS
+     * while it's waited for. follow - end of file isn't end of input, data
+     * appended to file is read as it comes until idle returns false.
+     * Both must be set before open().
+     */
+    void setIdle(InputIdle * idle, bool follow = false) {
+        mIdle = idle;
+        mFollow = follow && idle != nullptr;
+    }
+
+    // open file and detect its codec by first bytes
+    bool open(const std::string & path) {
+        close();
+        mError.clear();
+        mOwnFd = (path != "-");
+        if (!mOwnFd) {
+#ifdef WIN32
+            ::_setmode(0, _O_BINARY);
+#endif
+            mFd = 0;
+        } else {
+#ifdef WIN32
+            mFd = ::_open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+            mFd = ::open(path.c_str(), O_RDONLY);
+#endif
+        }
+        if (mFd < 0) {
+            mError = "can't open '" + path + "': " + ::strerror(errno);
+            return false;
+        }
+        mRaw.resize(1 << 20);
+        // magic could come by several reads from pipe
+        while (mRawLen < 4 && fill()) {}
+        if (!mError.empty()) {
+            close();
+            return false;
+        }
+        mCodec = detect(mRaw.data(), mRawLen);
+        if (!isSupported(mCodec)) {
+            mError = "'" + path + "' is " + codecName(mCodec) +
+                     "-compressed, but it's built without " +
+                     (mCodec == codecGzip ? "zlib." : "libzstd.");
+            close();
+            return false;
+        }
+        if (mCodec != codecNone) {
+            mOut.resize(1 << 20);
+            if (!initCodec()) {
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void close() {
+        if (mFd >= 0 && mOwnFd) {
+#ifdef WIN32
+            ::_close(mFd);
+#else
+            ::close(mFd);
+#endif
+        }
+        mFd = -1;
+        mCodec = codecNone;
+        mRawPos = mRawLen = 0;
+        mEof = false;
+        mBoundary = false;
+#ifdef HAVE_ZLIB
+        if (mZlibReady) inflateEnd(&mZlib);
+        mZlibReady = false;
+#endif
+#ifdef HAVE_ZSTD
+        if (mZstd != nullptr) ZSTD_freeDStream(mZstd);
+        mZstd = nullptr;
+#endif
+        setg(nullptr, nullptr, nullptr);
+    }
+
+    bool isOpen() const {
+        return mFd >= 0;
+    }
+    CODEC codec() const {
+        return mCodec;
+    }
+
+    // error of reading or decompression, stream ends at it
+    const std::string & errorString() const {
+        return mError;
+    }
+
+protected:
+    virtual int_type underflow() {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        if (mFd < 0 || !mError.empty())
+            return traits_type::eof();
+        size_t len = (mCodec == codecNone ? passRaw() : decode());
+        if (len == 0)
+            return traits_type::eof();
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    InputBuffer(const InputBuffer &);
+    InputBuffer & operator=(const InputBuffer &);
+
+    enum { IDLE_MS = 10 };
+
+    // input could be read without blocking, ms - how long to wait for it
+    bool ready(int ms) const {
+#ifdef WIN32
+        (void) ms;
+        return true;
+#else
+        struct pollfd pfd = { mFd, POLLIN, 0 };
+        return ::poll(&pfd, 1, ms) > 0;
+#endif
+    }
+
+    // read next chunk after unconsumed bytes of mRaw, false at end of input
+    bool fill() {
+        if (mEof)
+            return false;
+        if (mRawPos > 0) {
+            memmove(&mRaw[0], &mRaw[mRawPos], mRawLen - mRawPos);
+            mRawLen -= mRawPos;
+            mRawPos = 0;
+        }
+        for (;;) {
+            if (mIdle != nullptr && !ready(0)) {
+                if (!mIdle->idle()) {
+                    mEof = true;
+                    return false;
+                }
+                ready(IDLE_MS);
+                continue;
+            }
+#ifdef WIN32
+            int rv = ::_read(mFd, &mRaw[mRawLen], (unsigned) (mRaw.size() - mRawLen));
+#else
+            ssize_t rv = ::read(mFd, &mRaw[mRawLen], mRaw.size() - mRawLen);
+#endif
+            if (rv < 0) {
+                if (errno == EINTR) continue;
+                mError = std::string("read() failed: ") + ::strerror(errno);
+                return false;
+            }
+            if (rv == 0) {
+                // writer of followed file could append more
+                if (mFollow && mIdle->idle()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_MS));
+                    continue;
+                }
+                mEof = true;
+                return false;
+            }
+            mRawLen += rv;
+            return true;
+        }
+    }
+
+    // plain input is given from mRaw
+    size_t passRaw() {
+        if (mRawPos == mRawLen) {
+            mRawPos = mRawLen = 0;
+            if (!fill())
+                return 0;
+        }
+        char * p = &mRaw[mRawPos];
+        size_t len = mRawLen - mRawPos;
+        mRawPos = mRawLen;
+        setg(p, p, p + len);
+        return len;
+    }
+
+    bool initCodec() {
+#ifdef HAVE_ZLIB
+        if (mCodec == codecGzip) {
+            // gzip header is expected
+            if (inflateInit2(&mZlib, 15 + 16) != Z_OK) {
+                mError = "inflateInit2() failed.";
+                return false;
+            }
+            mZlibReady = true;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        if (mCodec == codecZstd) {
+            mZstd = ZSTD_createDStream();
+            if (mZstd == nullptr || ZSTD_isError(ZSTD_initDStream(mZstd))) {
+                mError = "ZSTD_initDStream() failed.";
+                return false;
+            }
+        }
+#endif
+        return true;
+    }
+
+    // decompress next piece into mOut, 0 at end of input or on error
+    size_t decode() {
+        size_t len = 0;
+        while (len == 0) {
+            if (mRawPos == mRawLen && !fill()) {
+                if (mError.empty() && !mBoundary)
+                    mError = std::string("truncated ") + codecName(mCodec) + " input.";
+                return 0;
+            }
+#ifdef HAVE_ZLIB
+            if (mCodec == codecGzip) {
+                if (mBoundary) {
+                    // next member could follow; like gzip does, bytes which
+                    // don't start with its magic (e.g. zero padding) are
+                    // ignored
+                    const unsigned char * p = (const unsigned char *) &mRaw[mRawPos];
+                    if (p[0] != 0x1f || (mRawLen - mRawPos > 1 && p[1] != 0x8b)) {
+                        mRawPos = mRawLen;
+                        return 0;
+                    }
+                    inflateReset(&mZlib);
+                }
+                mZlib.next_in = (Bytef *) &mRaw[mRawPos];
+                mZlib.avail_in = (uInt) (mRawLen - mRawPos);
+                mZlib.next_out = (Bytef *) &mOut[0];
+                mZlib.avail_out = (uInt) mOut.size();
+                int rv = inflate(&mZlib, Z_NO_FLUSH);
+                mRawPos = mRawLen - mZlib.avail_in;
+                len = mOut.size() - mZlib.avail_out;
+                mBoundary = (rv == Z_STREAM_END);
+                if (rv != Z_STREAM_END && rv != Z_OK && rv != Z_BUF_ERROR) {
+                    mError = "corrupted gzip input.";
+                    return 0;
+                }
+            }
+#endif
+#ifdef HAVE_ZSTD
+            if (mCodec == codecZstd) {
+                ZSTD_inBuffer in = { &mRaw[mRawPos], mRawLen - mRawPos, 0 };
+                ZSTD_outBuffer out = { &mOut[0], mOut.size(), 0 };
+                size_t rv = ZSTD_decompressStream(mZstd, &out, &in);
+                if (ZSTD_isError(rv)) {
+                    mError = std::string("corrupted zstd input: ") + ZSTD_getErrorName(rv);
+                    return 0;
+                }
+                mRawPos += in.pos;
+                len = out.pos;
+                mBoundary = (rv == 0);
+            }
+#endif
+        }
+        setg(&mOut[0], &mOut[0], &mOut[0] + len);
+        return len;
+    }
+
+    int mFd;
+    bool mOwnFd;                // it isn't standard input
+    InputIdle * mIdle;
+    bool mFollow;
+    CODEC mCodec;
+    std::vector<char> mRaw;     // input as it's read
+    size_t mRawPos;             // consumed bytes of mRaw
+    size_t mRawLen;
+    bool mEof;
+    bool mBoundary;             // compressed stream ended at member or frame
+    std::vector<char> mOut;     // decompressed data
+#ifdef HAVE_ZLIB
+    z_stream mZlib;
+    bool mZlibReady;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream * mZstd;
+#endif
+    std::string mError;
+}; // InputBuffer
+
+} // namespace op
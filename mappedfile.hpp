@@ -0,0 +1,178 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+namespace op {
+
+/*
+ * Read-only memory mapping of the whole input file. Only regular files
+ * can be mapped; for pipes and other non-seekable inputs open() fails
+ * and caller should fall back to the stream reading.
+ */
+
+class MappedFile {
+public:
+    MappedFile()
+        : mData(nullptr)
+        , mSize(0)
+#ifdef WIN32
+        , mFile(INVALID_HANDLE_VALUE)
+        , mMapping(NULL)
+#endif
+    {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    // path could be mapped, it's checked without opening it as opening
+    // of FIFO waits for writer
+    static bool isRegular(const std::string & path) {
+#ifdef WIN32
+        DWORD attrs = GetFileAttributesA(path.c_str());
+        return attrs != INVALID_FILE_ATTRIBUTES && !(attrs & FILE_ATTRIBUTE_DIRECTORY);
+#else
+        struct stat st;
+        return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+#endif
+    }
+
+    bool open(const std::string & path) {
+        close();
+#ifdef WIN32
+        mFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (mFile == INVALID_HANDLE_VALUE) {
+            mError = "can't open '" + path + "'.";
+            return false;
+        }
+        if (GetFileType(mFile) != FILE_TYPE_DISK) {
+            mError = "'" + path + "' is not a regular file.";
+            close();
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(mFile, &size)) {
+            mError = "can't get size of '" + path + "'.";
+            close();
+            return false;
+        }
+        mSize = (size_t) size.QuadPart;
+        if (mSize == 0) return true;
+        mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mMapping == NULL) {
+            mError = "CreateFileMapping() failed.";
+            close();
+            return false;
+        }
+        mData = (const char*) MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+        if (mData == nullptr) {
+            mError = "MapViewOfFile() failed.";
+            close();
+            return false;
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            mError = "can't open '" + path + "': " + ::strerror(errno);
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            mError = "'" + path + "' is not a regular file.";
+            ::close(fd);
+            return false;
+        }
+        mSize = (size_t) st.st_size;
+        if (mSize == 0) {
+            ::close(fd);
+            return true;
+        }
+        void * p = ::mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            mError = std::string("mmap() failed: ") + ::strerror(errno);
+            mSize = 0;
+            return false;
+        }
+        mData = (const char*) p;
+        // input is read once from begin to end
+        ::madvise(p, mSize, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        ::madvise(p, mSize, MADV_HUGEPAGE);
+#endif
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef WIN32
+        if (mData != nullptr) UnmapViewOfFile(mData);
+        if (mMapping != NULL) CloseHandle(mMapping);
+        if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+        mMapping = NULL;
+        mFile = INVALID_HANDLE_VALUE;
+#else
+        if (mData != nullptr) ::munmap((void*) mData, mSize);
+#endif
+        mData = nullptr;
+        mSize = 0;
+    }
+
+    const char * begin() const {
+        return mData;
+    }
+    const char * end() const {
+        return mData + mSize;
+    }
+    size_t size() const {
+        return mSize;
+    }
+
+    const std::string & errorString() const {
+        return mError;
+    }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile & operator=(const MappedFile &);
+
+    const char * mData;
+    size_t mSize;
+#ifdef WIN32
+    HANDLE mFile;
+    HANDLE mMapping;
+#endif
+    std::string mError;
+}; // MappedFile
+
+} // namespace op
@@ -15,179 +15,1040 @@
 //                                                                           //
 // ///////////////////////////////////////////////////////////////////////// //
 
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <unordered_set>
+#include <mutex>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <cstdint>
 #include "mflow.hpp"
 #include "pcapdumper.hpp"
+#include "flowevents.hpp"
+#include "reorderbuffer.hpp"
+#include "extsort.hpp"
+#include "flowindex.hpp"
+#include "flowfilter.hpp"
 #include "version.h"
 
-struct FlowsContext {
-    op::VariantPtr mNodePtr;
-    bool mRequest;
-    FlowsContext()
+// set by SIGINT or SIGTERM, live conversion is finished at it
+volatile std::sig_atomic_t gStop = 0;
+
+void onStop(int) {
+    gStop = 1;
+}
+
+// what was written to output file
+struct FileSummary {
+    bool mOK;
+    uint64_t mPackets;
+    uint64_t mBytes;
+    double mSeconds;
+
+    FileSummary()
+        : mOK(false)
+        , mPackets(0)
+        , mBytes(0)
+        , mSeconds(0)
     {}
-    FlowsContext(op::VariantPtr ptr, bool request)
-        : mNodePtr(ptr)
-        , mRequest(request)
+};
+
+// how pcap files are written
+struct OutputOptions {
+    size_t mBufferSize;     // bytes buffered before write
+    uint64_t mPreallocate;  // bytes reserved on disk for output
+    bool mStats;            // report written bytes
+    op::PCapDumper::FORMAT mFormat;
+    bool mOffline;          // don't call resolver for host names
+    op::CHECKSUM mChecksum;
+    op::PCapDumper::Rotation mRotation;
+    op::PCapDumper::SPLIT mSplit;
+    size_t mMaxOpen;        // files of split output kept open
+    op::FileFinisher::COMPRESSION mCompression;
+    int mCompressionLevel;
+    FileSummary * mSummary; // filled by closeDumper() if it's set
+
+    OutputOptions()
+        : mBufferSize(8 << 20)
+        , mPreallocate(0)
+        , mStats(false)
+        , mFormat(op::PCapDumper::fmtPcap)
+        , mOffline(false)
+        , mChecksum(op::csumAuto)
+        , mSplit(op::PCapDumper::splitNone)
+        , mMaxOpen(256)
+        , mCompression(op::FileFinisher::cmpNone)
+        , mCompressionLevel(6)
+        , mSummary(nullptr)
     {}
 };
-typedef std::map< timeval, FlowsContext > FlowsByTimeStamp;
 
-bool operator< (const timeval & a, const timeval & b) {
-    return a.tv_sec  < b.tv_sec ||
-          (a.tv_sec == b.tv_sec && a.tv_usec < b.tv_usec);
+// apply options which aren't given to dumper's constructor
+bool configureDumper(op::PCapDumper & dumper, const OutputOptions & output) {
+    if (!dumper.isOK()) {
+        std::cerr << "ERR: " << dumper.errorString() << std::endl;
+        return false;
+    }
+    if (!dumper.setChecksum(output.mChecksum)) {
+        std::cerr << "ERR: " << op::checksumName(output.mChecksum)
+                  << " checksum isn't supported by CPU." << std::endl;
+        return false;
+    }
+    dumper.resolver().setOffline(output.mOffline);
+    dumper.setRotation(output.mRotation);
+    if (output.mSplit != op::PCapDumper::splitNone)
+        dumper.setSplit(output.mSplit, output.mMaxOpen);
+    if (!dumper.setCompression(output.mCompression, output.mCompressionLevel,
+                               op::hardwareThreads())) {
+        std::cerr << "ERR: " << dumper.errorString() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// resolve hosts of events before they are dumped, all names at once
+void resolveHosts(op::PCapDumper & dumper, const std::unordered_set<std::string> & unique) {
+    std::vector<std::string> hosts(unique.begin(), unique.end());
+    dumper.resolver().prefetch(hosts);
 }
 
-bool dumpFlows(const op::MFlowParser & parsedFlows, const std::string & outPath) {
-    // create dumper object
-    op::PCapDumper dumper(outPath);
-    if (!dumper.isOK()) {
+// flush and close output file reporting errors
+bool closeDumper(op::PCapDumper & dumper, const std::string & outPath,
+                 const OutputOptions & output) {
+    if (!dumper.close()) {
         std::cerr << "ERR: " << dumper.errorString() << std::endl;
         return false;
     }
+    if (dumper.skipped() != 0) {
+        std::cerr << "WARN: " << dumper.skipped() << " events were skipped as addresses of "
+                     "their server and client weren't resolved to one family." << std::endl;
+    }
+    if (output.mStats) {
+        std::cerr << "written " << dumper.bytesWritten() << " bytes to '"
+                  << outPath << "'";
+        if (dumper.split() != op::PCapDumper::splitNone)
+            std::cerr << " split into " << dumper.files() << " files";
+        else if (dumper.files() > 1)
+            std::cerr << " and " << dumper.files() - 1 << " next files";
+        std::cerr << std::endl;
+        if (dumper.connections().evicted() != 0) {
+            std::cerr << "evicted " << dumper.connections().evicted()
+                      << " connections without pending events" << std::endl;
+        }
+    }
+    if (output.mSummary != nullptr) {
+        output.mSummary->mPackets = dumper.packets();
+        output.mSummary->mBytes = dumper.bytesWritten();
+    }
+    return true;
+}
+
+// build packets of events in parallel and write them in order by one thread
+void dumpEventsParallel(op::PCapDumper & dumper, const op::FlowEvents & events, unsigned threads) {
+    // TCP numbers are given to messages in order of events
+    std::vector<op::PCapDumper::Message> messages(events.size());
+    std::vector<bool> valid(events.size());
+    for (size_t i = 0; i < events.size(); ++i) {
+        valid[i] = op::setEventAddrs(dumper, events[i]);
+        if (valid[i]) {
+            messages[i] = dumper.message(op::httpLength(events[i]),
+                                         events[i].mTs, events[i].mRequest,
+                                         op::flowId(dumper, events[i]));
+        }
+    }
+
+    // each batch gets packets of chunk of events
+    const size_t CHUNK = 64;
+    struct Producer {
+        const op::FlowEvents & mEvents;
+        const std::vector<op::PCapDumper::Message> & mMessages;
+        const std::vector<bool> & mValid;
+        void operator()(size_t index, op::PCapDumper::PacketBatch & batch) const {
+            std::vector<op::Slice> pieces;
+            batch.clear();
+            size_t end = std::min(mEvents.size(), (index + 1) * CHUNK);
+            for (size_t i = index * CHUNK; i < end; ++i) {
+                if (!mValid[i]) continue;
+                op::httpPieces(mEvents[i], pieces);
+                op::PCapDumper::build(mMessages[i], pieces.data(), pieces.size(), batch);
+            }
+        }
+    } producer = { events, messages, valid };
+    struct Consumer {
+        op::PCapDumper & mDumper;
+        void operator()(const op::PCapDumper::PacketBatch & batch) const {
+            mDumper.write(batch);
+        }
+    } consumer = { dumper };
+    size_t chunks = (events.size() + CHUNK - 1) / CHUNK;
+    op::orderedPipeline<op::PCapDumper::PacketBatch>(threads, chunks, producer, consumer,
+                                                     threads * 4);
+} // dumpEventsParallel
+
+bool dumpFlows(const op::MFlowParser & parsedFlows, const std::string & outPath,
+               const OutputOptions & output, unsigned threads) {
+    // create dumper object
+    op::PCapDumper dumper(outPath, output.mFormat, output.mBufferSize, output.mPreallocate);
+    if (!configureDumper(dumper, output))
+        return false;
 
     // sort requests/responses for each flow by timestamp
-    FlowsByTimeStamp flows; {
+    op::FlowEvents flows; {
         op::ValuesVector & v = parsedFlows.itemsVec();
         for (unsigned i = 0; i < v.size(); ++i) {
-            op::KeyValueMap & obj = v.at(i)->asMap();
-            const std::string & type = obj["type"]->asString();
-            if (type.compare("http") != 0) {
-                std::cerr << "WARN: ignored flow with type '" << type << "'" << std::endl;
-                continue;
+            op::collectEvents(v.at(i), i, flows);
+        }
+        std::sort(flows.begin(), flows.end());
+    }
+    {
+        std::unordered_set<std::string> hosts;
+        std::vector<std::string> pair;
+        for (size_t i = 0; i < flows.size(); ++i) {
+            pair.clear();
+            op::eventHosts(flows[i], pair);
+            hosts.insert(pair.begin(), pair.end());
+        }
+        resolveHosts(dumper, hosts);
+    }
+
+    // dump each HTTP request/response according its timestamps
+    if (threads > 1) {
+        dumpEventsParallel(dumper, flows, threads);
+    } else {
+        for (op::FlowEvents::const_iterator it = flows.begin(); it != flows.end(); ++it) {
+            op::dumpEvent(dumper, *it);
+        }
+    }
+    return closeDumper(dumper, outPath, output);
+} // dumpFlows
+
+// parse flows one by one and dump them through reorder window; input
+// which is stdin or followed is live: packets are written out whenever
+// its data which is ready is parsed
+bool streamFlows(const std::string & inPath, const std::string & outPath,
+                 const OutputOptions & output, const op::FlowFilter & filter,
+                 size_t windowCount, int64_t windowSpan, bool follow) {
+    struct Writer {
+        op::PCapDumper & mDumper;
+        void operator()(const op::FlowEvent & event) const {
+            op::dumpEvent(mDumper, event);
+            op::ConnKey key;
+            if (op::eventConn(mDumper, event, key))
+                mDumper.release(key);
+        }
+    };
+    // packets are written at once, events held by window when input
+    // pauses for QUIET idle calls (10 ms apart)
+    struct Live : public op::InputIdle {
+        enum { QUIET = 5 };
+        op::ReorderBuffer<op::FlowEvent> * mWindow;
+        const Writer * mWriter;
+        bool mPending;      // packets were built after last flush
+        unsigned mQuiet;    // idle calls after last record
+        virtual bool idle() {
+            if (++mQuiet == QUIET && mWindow != nullptr && mWindow->size() != 0) {
+                mWindow->flush(*mWriter);
+                mPending = true;
             }
+            if (mPending) {
+                mWriter->mDumper.flush();
+                mPending = false;
+            }
+            return !gStop;
+        }
+    } live;
+    live.mWindow = nullptr;
+    live.mPending = false;
+    live.mQuiet = 0;
+
+    op::MFlowParser parser;
+    parser.setProjection(&op::eventProjection());
+    parser.setFilter(filter.empty() ? nullptr : &filter);
+    if (follow || inPath == "-") {
+        std::signal(SIGINT, onStop);
+        std::signal(SIGTERM, onStop);
+        parser.setIdle(&live, follow);
+    }
+    if (!parser.open(inPath)) {
+        std::cerr << "ERR: " << parser.errorString() << std::endl;
+        return false;
+    }
+    op::PCapDumper dumper(outPath, output.mFormat, output.mBufferSize, output.mPreallocate);
+    if (!configureDumper(dumper, output))
+        return false;
 
-            struct timeval ts;
-            op::KeyValueMap & req = obj["request"]->asMap();
-            sscanf(req["timestamp_start"]->asString().c_str(), "%10ld.%06ld", &ts.tv_sec, &ts.tv_usec);
-            flows[ts] = FlowsContext(v.at(i), true);
+    // connections are dropped from dumper when their events are written
+    dumper.setEviction(true);
+    Writer writer = { dumper };
 
-            op::KeyValueMap & resp = obj["response"]->asMap();
-            sscanf(resp["timestamp_start"]->asString().c_str(), "%10ld.%06ld", &ts.tv_sec, &ts.tv_usec);
-            flows[ts] = FlowsContext(v.at(i), false);
+    op::ReorderBuffer<op::FlowEvent> window(windowCount, windowSpan);
+    live.mWindow = &window;
+    live.mWriter = &writer;
+    op::FlowEvents events;
+    op::MFlowParser::Record rec;
+    for (uint64_t i = 0; parser.nextRecord(rec); ++i) {
+        // each flow has own arena released after its events are written
+        std::shared_ptr<op::Arena> arena(new op::Arena(1 << 14));
+        events.clear();
+        op::collectEvents(parser.parseSelected(rec, *arena), i, events, arena);
+        for (size_t j = 0; j < events.size(); ++j) {
+            op::ConnKey key;
+            if (op::eventConn(dumper, events[j], key))
+                dumper.retain(key);
+            window.push(events[j], writer);
         }
+        live.mPending = true;
+        live.mQuiet = 0;
     }
+    window.flush(writer);
 
-    // dump each HTTP request/response according its timestamps
-    for (FlowsByTimeStamp::const_iterator it = flows.begin(); it != flows.end(); ++it) {
-        op::KeyValueMap & obj = it->second.mNodePtr->asMap();
-        {
-            // parse ip:port of source and destination
-            op::KeyValueMap & server_conn = obj["server_conn"]->asMap();
-            if (server_conn["ip_address"]->isMap()) {
-                // old versions
-                op::ValuesVector & addrSrv = server_conn["ip_address"]->asMap()["address"]->asVector();
-                op::ValuesVector & addrCli = server_conn["source_address"]->asMap()["address"]->asVector();
-                assert(addrSrv.size() >= 2);
-                assert(addrCli.size() >= 2);
-                dumper.setAddrs(addrSrv[0]->asString(), addrSrv[1]->asString(),
-                        addrCli[0]->asString(), addrCli[1]->asString());
-#if (0)
-                std::string k (addrSrv[0]->asString() + ":" + addrSrv[1]->asString() + ":" +
-                        addrCli[0]->asString() + ":" + addrCli[1]->asString());
-                std::cout << it->first.tv_sec << "." << it->first.tv_usec
-                          << " " << it->second.mRequest
-                          << " " << k
-                          << std::endl;
-#endif
-            } else {
-                // new version of flow
-                op::ValuesVector & addrSrv = server_conn["ip_address"]->asVector();
-                op::ValuesVector & addrCli = server_conn["source_address"]->asVector();
-                assert(addrSrv.size() >= 2);
-                assert(addrCli.size() >= 2);
-                dumper.setAddrs(addrSrv[0]->asString(), addrSrv[1]->asString(),
-                        addrCli[0]->asString(), addrCli[1]->asString());
-#if (0)
-                std::string k (addrSrv[0]->asString() + ":" + addrSrv[1]->asString() + ":" +
-                        addrCli[0]->asString() + ":" + addrCli[1]->asString());
-                std::cout << it->first.tv_sec << "." << it->first.tv_usec
-                          << " " << it->second.mRequest
-                          << " " << k
-                          << std::endl;
-#endif
+    if (parser.isError()) {
+        std::cerr << "WARN: " << parser.errorString() << std::endl;
+    }
+    if (window.late() != 0) {
+        std::cerr << "WARN: " << window.late() << " events came later than reorder window "
+                     "allows and were written out of order." << std::endl;
+    }
+    return closeDumper(dumper, outPath, output);
+} // streamFlows
+
+// give events and hosts of flows from sidecar index to sorter, index is
+// built when it's missing or stale; flows are parsed only when filter
+// needs more than index has
+template <class Sorter>
+bool sortIndexed(op::MFlowParser & parser, const std::string & inPath,
+                 const op::FlowFilter & filter, Sorter & sorter,
+                 std::unordered_set<std::string> & hosts) {
+    op::FlowIndex index;
+    if (!index.load(inPath)) {
+        index.build(parser);
+        // index of truncated input isn't kept
+        if (!parser.isError() && !index.save(inPath)) {
+            std::cerr << "WARN: " << index.errorString() << std::endl;
+        }
+    }
+    op::Arena arena(1 << 14);
+    op::MFlowParser::Record rec;
+    for (size_t i = 0; i < index.size(); ++i) {
+        const op::IndexEntry & e = index[i];
+        if (e.mType == op::FlowIndex::NONE || !filter.acceptEntry(index, e))
+            continue;
+        if (filter.needsRecord()) {
+            arena.clear();
+            if (!parser.recordAt(e.mOffset, e.mPrefix, e.mLength, rec) ||
+                !parser.accept(rec, arena))
+                continue;
+        }
+        if (index.string(e.mType) != "http") {
+            std::cerr << "WARN: ignored flow with type '" << index.string(e.mType) << "'" << std::endl;
+            continue;
+        }
+        if (e.mSrv != op::FlowIndex::NONE) {
+            hosts.insert(index.string(e.mSrv).str());
+            hosts.insert(index.string(e.mCli).str());
+        }
+        op::FlowEventRef req = { e.mReqTs, i * 2, e.mOffset };
+        op::FlowEventRef resp = { e.mRespTs, i * 2 + 1, e.mOffset };
+        if (((e.mFlags & op::FlowIndex::HAS_REQUEST) && !sorter.add(req)) ||
+            ((e.mFlags & op::FlowIndex::HAS_RESPONSE) && !sorter.add(resp))) {
+            std::cerr << "ERR: " << sorter.errorString() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// open input whose records are read again by offsets after sorting
+bool openSeekable(op::MFlowParser & parser, const std::string & inPath,
+                  const op::FlowFilter & filter) {
+    parser.setProjection(&op::eventProjection());
+    parser.setFilter(filter.empty() ? nullptr : &filter);
+    if (!parser.open(inPath)) {
+        std::cerr << "ERR: " << parser.errorString() << std::endl;
+        return false;
+    }
+    if (!parser.isMapped()) {
+        std::cerr << "ERR: sorting out of memory needs seekable input file." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// give compact events of input to sorter and hosts of their flows to hosts
+template <class Sorter>
+bool collectRefs(op::MFlowParser & parser, const std::string & inPath,
+                 const op::FlowFilter & filter, bool useIndex, Sorter & sorter,
+                 std::unordered_set<std::string> & hosts) {
+    if (useIndex)
+        return sortIndexed(parser, inPath, filter, sorter, hosts);
+    op::Arena arena(1 << 16);
+    op::FlowEvents events;
+    std::vector<std::string> pair;
+    op::MFlowParser::Record rec;
+    for (uint64_t i = 0; parser.nextRecord(rec); ++i) {
+        arena.clear();
+        events.clear();
+        op::collectEvents(parser.parseSelected(rec, arena), i, events);
+        if (!events.empty()) {
+            pair.clear();
+            op::eventHosts(events[0], pair);
+            hosts.insert(pair.begin(), pair.end());
+        }
+        for (size_t j = 0; j < events.size(); ++j) {
+            op::FlowEventRef ref = { events[j].mTs, events[j].mOrder, rec.mOffset };
+            if (!sorter.add(ref)) {
+                std::cerr << "ERR: " << sorter.errorString() << std::endl;
+                return false;
             }
-        }{
-            // rebuild HTTP request/response
-            std::stringstream ss;
-            if (it->second.mRequest == true) {
-                op::KeyValueMap & req = obj["request"]->asMap();
-                ss << req["method"]->asString() << " ";
-                ss << req["path"]->asString() << " ";
-                ss << req["http_version"]->asString() << "\r\n";
-                {
-                    op::ValuesVector & h = req["headers"]->asVector();
-                    for (unsigned i = 0; i < h.size(); ++i) {
-                        op::ValuesVector & hh = h[i]->asVector();
-                        assert(hh.size() >= 2);
-                        ss << hh[0]->asString() << ": "
-                           << hh[1]->asString() << "\r\n";
-                    }
-                }
-                ss << "\r\n";
-                ss << req["content"]->asString();
-            } else {
-                op::KeyValueMap & resp = obj["response"]->asMap();
-                ss << resp["http_version"]->asString() << " ";
-                ss << resp["status_code"]->asString() << " ";
-                ss << resp["reason"]->asString() << "\r\n";
-                {
-                    op::ValuesVector & h = resp["headers"]->asVector();
-                    for (unsigned i = 0; i < h.size(); ++i) {
-                        op::ValuesVector & hh = h[i]->asVector();
-                        assert(hh.size() >= 2);
-                        ss << hh[0]->asString() << ": "
-                           << hh[1]->asString() << "\r\n";
-                    }
-                }
-                ss << "\r\n";
-                ss << resp["content"]->asString();
+        }
+    }
+    if (parser.isError()) {
+        std::cerr << "WARN: " << parser.errorString() << std::endl;
+    }
+    return true;
+}
+
+// dump event parsing its flow from input by offset
+void dumpRef(op::MFlowParser & parser, op::PCapDumper & dumper, op::Arena & arena,
+             const op::FlowEventRef & ref) {
+    op::MFlowParser::Record rec;
+    arena.clear();
+    if (!parser.recordAt(ref.mOffset, rec))
+        return;
+    op::FlowEvent event(ref.mTs, ref.mOrder / 2,
+                        parser.parseRecord(rec, arena), ref.isRequest());
+    op::dumpEvent(dumper, event);
+}
+
+// sort events out of memory and dump them parsing their flows once again,
+// with index only flows of events are parsed
+bool sortFlows(const std::string & inPath, const std::string & outPath,
+               const OutputOptions & output, const op::FlowFilter & filter,
+               size_t maxMemory, const std::string & tempDir, bool useIndex) {
+    op::MFlowParser parser;
+    if (!openSeekable(parser, inPath, filter))
+        return false;
+    op::PCapDumper dumper(outPath, output.mFormat, output.mBufferSize, output.mPreallocate);
+    if (!configureDumper(dumper, output))
+        return false;
+
+    // collect compact events, sorted runs of them are spilled to disk
+    op::ExternalSorter<op::FlowEventRef> sorter(maxMemory, tempDir);
+    std::unordered_set<std::string> hosts;
+    if (!collectRefs(parser, inPath, filter, useIndex, sorter, hosts))
+        return false;
+    resolveHosts(dumper, hosts);
+
+    // merge runs and dump events reading flows by their offsets
+    op::Arena arena(1 << 16);
+    struct Writer {
+        op::MFlowParser & mParser;
+        op::PCapDumper & mDumper;
+        op::Arena & mArena;
+        void operator()(const op::FlowEventRef & ref) const {
+            dumpRef(mParser, mDumper, mArena, ref);
+        }
+    } writer = { parser, dumper, arena };
+    if (!sorter.merge(writer)) {
+        std::cerr << "ERR: " << sorter.errorString() << std::endl;
+        return false;
+    }
+    return closeDumper(dumper, outPath, output);
+} // sortFlows
+
+// event of one of merged inputs, ties are ordered by input
+struct SourceRef {
+    op::FlowEventRef mRef;
+    uint64_t mSource;
+
+    bool operator<(const SourceRef & other) const {
+        if (mRef < other.mRef) return true;
+        if (other.mRef < mRef) return false;
+        return mSource < other.mSource;
+    }
+}; // SourceRef
+
+/*
+ * Adds events of one input to the sorter shared by merged inputs. They
+ * are passed in batches under lock as inputs are read concurrently.
+ */
+class SourceSink {
+public:
+    enum { BATCH = 4096 };
+
+    SourceSink(op::ExternalSorter<SourceRef> & sorter, std::mutex & lock, size_t source)
+        : mSorter(sorter)
+        , mLock(lock)
+        , mSource(source)
+    {
+        mBatch.reserve(BATCH);
+    }
+
+    bool add(const op::FlowEventRef & ref) {
+        SourceRef sref = { ref, mSource };
+        mBatch.push_back(sref);
+        return mBatch.size() < BATCH || flush();
+    }
+
+    bool flush() {
+        std::lock_guard<std::mutex> guard(mLock);
+        for (size_t i = 0; i < mBatch.size(); ++i) {
+            if (!mSorter.add(mBatch[i]))
+                return false;
+        }
+        mBatch.clear();
+        return true;
+    }
+
+    std::string errorString() const {
+        std::lock_guard<std::mutex> guard(mLock);
+        return mSorter.errorString();
+    }
+
+private:
+    op::ExternalSorter<SourceRef> & mSorter;
+    std::mutex & mLock;
+    uint64_t mSource;
+    std::vector<SourceRef> mBatch;
+}; // SourceSink
+
+// sort events of all inputs together and merge them by time into one
+// output; one sorter is shared by inputs, so its memory and open runs
+// don't grow with their number. Connections seen in several inputs keep
+// their TCP state.
+bool mergeFlows(const std::vector<std::string> & inPaths, const std::string & outPath,
+                const OutputOptions & output, const op::FlowFilter & filter,
+                size_t maxMemory, const std::string & tempDir, bool useIndex,
+                unsigned jobs) {
+    struct Source {
+        op::MFlowParser mParser;
+        std::unordered_set<std::string> mHosts;
+        bool mOK;
+        Source() : mOK(false) {}
+    };
+    std::vector<std::unique_ptr<Source> > sources;
+    for (size_t i = 0; i < inPaths.size(); ++i) {
+        sources.push_back(std::unique_ptr<Source>(new Source()));
+    }
+    op::PCapDumper dumper(outPath, output.mFormat, output.mBufferSize, output.mPreallocate);
+    if (!configureDumper(dumper, output))
+        return false;
+
+    // inputs are read concurrently
+    op::ExternalSorter<SourceRef> sorter(maxMemory, tempDir);
+    std::mutex lock;
+    struct Collect {
+        const std::vector<std::string> & mPaths;
+        std::vector<std::unique_ptr<Source> > & mSources;
+        const op::FlowFilter & mFilter;
+        bool mUseIndex;
+        op::ExternalSorter<SourceRef> & mSorter;
+        std::mutex & mLock;
+        void operator()(size_t i, unsigned) const {
+            Source & src = *mSources[i];
+            SourceSink sink(mSorter, mLock, i);
+            src.mOK = openSeekable(src.mParser, mPaths[i], mFilter) &&
+                      collectRefs(src.mParser, mPaths[i], mFilter, mUseIndex,
+                                  sink, src.mHosts);
+            if (src.mOK && !sink.flush()) {
+                std::cerr << "ERR: " << sink.errorString() << std::endl;
+                src.mOK = false;
             }
-            // ... and dump it
-            const std::string & http = ss.str();
-            dumper.dump((const u_char*) http.c_str(), http.size(), it->first, it->second.mRequest);
         }
+    } collect = { inPaths, sources, filter, useIndex, sorter, lock };
+    op::parallelFor(std::min<size_t>(jobs, inPaths.size()), inPaths.size(), collect);
+    std::unordered_set<std::string> hosts;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (!sources[i]->mOK)
+            return false;
+        hosts.insert(sources[i]->mHosts.begin(), sources[i]->mHosts.end());
+        std::unordered_set<std::string>().swap(sources[i]->mHosts);
+    }
+    resolveHosts(dumper, hosts);
+
+    // merge runs and dump events reading flows from their inputs
+    op::Arena arena(1 << 16);
+    struct Writer {
+        std::vector<std::unique_ptr<Source> > & mSources;
+        op::PCapDumper & mDumper;
+        op::Arena & mArena;
+        void operator()(const SourceRef & ref) const {
+            dumpRef(mSources[ref.mSource]->mParser, mDumper, mArena, ref.mRef);
+        }
+    } writer = { sources, dumper, arena };
+    if (!sorter.merge(writer)) {
+        std::cerr << "ERR: " << sorter.errorString() << std::endl;
+        return false;
+    }
+    return closeDumper(dumper, outPath, output);
+} // mergeFlows
+
+// add files of directory to paths, outputs of conversion are skipped
+bool listFlowFiles(const std::string & dir, std::vector<std::string> & paths) {
+    static const char * const SKIP[] = { ".pcap", ".pcapng", ".mfidx", ".tmp" };
+    std::vector<std::string> names;
+#ifdef WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+        return false;
+    do {
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            names.push_back(data.cFileName);
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR * d = opendir(dir.c_str());
+    if (d == nullptr)
+        return false;
+    while (struct dirent * entry = readdir(d)) {
+        struct stat st;
+        std::string path = dir + "/" + entry->d_name;
+        if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            names.push_back(entry->d_name);
+    }
+    closedir(d);
+#endif
+    std::sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); ++i) {
+        bool skip = (names[i][0] == '.');
+        for (size_t k = 0; k < sizeof(SKIP) / sizeof(SKIP[0]) && !skip; ++k) {
+            size_t len = strlen(SKIP[k]);
+            skip = names[i].size() > len &&
+                   !names[i].compare(names[i].size() - len, len, SKIP[k]);
+        }
+        if (!skip)
+            paths.push_back(dir + "/" + names[i]);
     }
     return true;
-} // dumpFlows
+}
+
+bool isDirectory(const std::string & path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
 
 // parsing command options
 struct CommandOptions {
-    std::string mInputPath;
+    std::vector<std::string> mInputPaths;
+    std::string mOutputDir;
+    std::string mOutputFile;
+    unsigned mJobs;
+    bool mMerge;
     bool mPrint;
     bool mDump;
+    bool mStats;
     bool mShowUsage;
+    bool mStream;
+    bool mFollow;
+    size_t mWindowCount;
+    int64_t mWindowSpan;
+    size_t mMaxMemory;
+    std::string mTempDir;
+    unsigned mThreads;
+    bool mIndex;
+    bool mBadOption;        // value of option is wrong
+    bool mUsageOnly;        // --help or no arguments
+    OutputOptions mOutput;
+    op::FlowFilter mFilter;
 
     void usage() {
         std::cout
             << "mitmproxy2pcap v" << _VERSION_ << " " << _PROD_COPYRIGHT_ "\n"
             << "mitmproxy flow files converter to pcap.\n"
             << "\n"
-            << "mitmproxy2pcap [OPTIONS] path_to_input_file\n"
+            << "mitmproxy2pcap [OPTIONS] path_to_input_file|directory... [-]\n"
+            << "\n"
+            << "Input `-` is stdin, its packets are written to stdout; `-` after\n"
+            << "input file writes them to stdout too, e.g.\n"
+            << "mitmdump -w - | mitmproxy2pcap - - | tshark -r -\n"
             << "\n"
             << "OPTIONS:\n"
             << "--print  - just print json representation of parsed flows and exit.\n"
+            << "--stats  - print memory usage of parsed flows and size of output\n"
+            << "           to stderr.\n"
+            << "--reorder-window N|Ts - convert flows one by one, sorting events\n"
+            << "           in window of N events or T seconds (e.g. 2.5s).\n"
+            << "--max-memory SIZE - sort events on disk using not more than SIZE\n"
+            << "           bytes (suffixes K, M, G) of memory for them.\n"
+            << "--temp-dir DIR - where sorted runs are kept, $TMPDIR by default.\n"
+            << "--type T[,T..] - convert only flows of these types.\n"
+            << "--host H[,H..] - only flows with request to host H or server\n"
+            << "           address H.\n"
+            << "--method M[,M..] - only flows with request method M.\n"
+            << "--status S[,S..] - only flows with response status S, e.g.\n"
+            << "           404 or 5xx.\n"
+            << "--since TIME, --until TIME - only flows which start in [since,\n"
+            << "           until). TIME is seconds since epoch or UTC date and\n"
+            << "           time: 2018-10-09, 2018-10-09T11:26:14.5\n"
+            << "--index  - find records by sidecar index <input>.mfidx, it's\n"
+            << "           built when it's missing or input has changed.\n"
+            << "--threads N - parse flows and build packets using N threads\n"
+            << "           (0 - all cores).\n"
+            << "--jobs N - convert N input files at once (0 - all cores).\n"
+            << "--output-dir DIR - where output files are written, next to\n"
+            << "           input files by default.\n"
+            << "--merge  - merge events of all inputs by time into one output.\n"
+            << "--output FILE - output of single input or of --merge (merged.pcap\n"
+            << "           by default), `-` is stdout.\n"
+            << "--follow - convert records appended to input file until it's\n"
+            << "           interrupted, packets are written as soon as they\n"
+            << "           are parsed.\n"
+            << "--write-buffer SIZE - output buffer size, 8M by default.\n"
+            << "--preallocate SIZE - reserve SIZE bytes on disk for output.\n"
+            << "--max-file-size SIZE, --max-packets N, --max-file-duration T -\n"
+            << "           start next output file (out1.pcap, out2.pcap..) when\n"
+            << "           one of limits is reached, T is seconds of capture.\n"
+            << "--compress gzip[:LEVEL]|zstd[:LEVEL] - gzip complete output\n"
+            << "           files or write them zstd-compressed using all cores.\n"
+            << "           Input compressed by gzip or zstd is read as it is.\n"
+            << "--split-by host|connection - write file per server address or\n"
+            << "           per connection, e.g. out.10.0.0.1.pcap.\n"
+            << "--max-open-files N - files of split output kept open, 256 by\n"
+            << "           default.\n"
+            << "--offline - don't resolve host names, they get synthetic\n"
+            << "           addresses from 10.0.0.0/8 and fd00::/8.\n"
+            << "--checksum auto|scalar|sse2|avx2|none - how IP and TCP checksums\n"
+            << "           are computed, auto by default.\n"
+            << "--format pcap|pcapng - output file format, pcap by default. pcapng\n"
+            << "           has nanosecond timestamps and flow id in packet comments.\n"
             << "--help   - this output.\n";
     }
 
+    // "a,b" -> { "a", "b" }
+    static std::vector<std::string> splitList(const char * value) {
+        std::vector<std::string> items;
+        std::stringstream ss(value);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (!item.empty()) items.push_back(item);
+        }
+        return items;
+    }
+
+    // non-negative decimal number without suffix
+    static bool parseCount(const char * value, unsigned & n) {
+        int64_t v;
+        if (!op::parseInt(value, value + strlen(value), v) || v < 0 || v > 0xFFFFFFFFLL)
+            return false;
+        n = (unsigned) v;
+        return true;
+    }
+
+    // "64M" -> 67108864
+    static bool parseSize(const char * value, size_t & size) {
+        char * end = nullptr;
+        errno = 0;
+        unsigned long long n = strtoull(value, &end, 10);
+        const char * suffix = end;
+        unsigned shift = 0;
+        switch (*end) {
+        case 'G': case 'g': shift += 10; // fall through
+        case 'M': case 'm': shift += 10; // fall through
+        case 'K': case 'k': shift += 10; ++suffix; break;
+        default: break;
+        }
+        if (end == value || errno == ERANGE || n == 0 || n > (SIZE_MAX >> shift) ||
+            *suffix != '\0' || *value == '-') {
+            std::cerr << "ERR: bad size '" << value << "'" << std::endl;
+            return false;
+        }
+        size = (size_t) n << shift;
+        return true;
+    }
+
     CommandOptions(int argc, char ** argv)
-        : mPrint(false)
+        : mJobs(1)
+        , mMerge(false)
+        , mPrint(false)
         , mDump(false)
+        , mStats(false)
         , mShowUsage(false)
+        , mStream(false)
+        , mFollow(false)
+        , mWindowCount(0)
+        , mWindowSpan(0)
+        , mMaxMemory(0)
+        , mThreads(1)
+        , mIndex(false)
+        , mBadOption(false)
+        , mUsageOnly(false)
     {
+        bool help = false;
         for (int i = 1; i < argc; ++i) {
             if (!::strcmp(argv[i], "--help")) {
-                mShowUsage = true;
+                help = true;
             } else if (!::strcmp(argv[i], "--print")) {
                 mPrint = true;
+            } else if (!::strcmp(argv[i], "--stats")) {
+                mStats = true;
+                mOutput.mStats = true;
+            } else if (!::strcmp(argv[i], "--reorder-window") && i + 1 < argc) {
+                // count of events or seconds with fraction
+                const char * value = argv[++i];
+                size_t len = strlen(value);
+                bool span = (len && value[len - 1] == 's');
+                int64_t n;
+                bool ok = (span ? op::parseNanos(value, value + len - 1, n)
+                                : op::parseInt(value, value + len, n));
+                if (!ok || n <= 0) {
+                    std::cerr << "ERR: bad reorder window '" << value << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                if (span) {
+                    mWindowSpan = n;
+                } else {
+                    mWindowCount = (size_t) n;
+                }
+                mStream = true;
+            } else if (!::strcmp(argv[i], "--max-memory") && i + 1 < argc) {
+                if (!parseSize(argv[++i], mMaxMemory)) {
+                    mBadOption = true;
+                    break;
+                }
+            } else if (!::strcmp(argv[i], "--write-buffer") && i + 1 < argc) {
+                if (!parseSize(argv[++i], mOutput.mBufferSize)) {
+                    mBadOption = true;
+                    break;
+                }
+            } else if (!::strcmp(argv[i], "--preallocate") && i + 1 < argc) {
+                size_t size;
+                if (!parseSize(argv[++i], size)) {
+                    mBadOption = true;
+                    break;
+                }
+                mOutput.mPreallocate = size;
+            } else if (!::strcmp(argv[i], "--max-file-size") && i + 1 < argc) {
+                size_t size;
+                if (!parseSize(argv[++i], size)) {
+                    mBadOption = true;
+                    break;
+                }
+                mOutput.mRotation.mMaxBytes = size;
+            } else if (!::strcmp(argv[i], "--max-packets") && i + 1 < argc) {
+                const char * value = argv[++i];
+                int64_t n;
+                if (!op::parseInt(value, value + strlen(value), n) || n <= 0) {
+                    std::cerr << "ERR: bad number of packets '" << value << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                mOutput.mRotation.mMaxPackets = (uint64_t) n;
+            } else if (!::strcmp(argv[i], "--max-file-duration") && i + 1 < argc) {
+                const char * value = argv[++i];
+                size_t len = strlen(value);
+                if (len && value[len - 1] == 's') --len;
+                int64_t ns;
+                if (!op::parseNanos(value, value + len, ns) || ns <= 0) {
+                    std::cerr << "ERR: bad duration '" << value << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                mOutput.mRotation.mMaxSpan = ns;
+            } else if (!::strcmp(argv[i], "--split-by") && i + 1 < argc) {
+                const char * value = argv[++i];
+                if (!::strcmp(value, "host")) {
+                    mOutput.mSplit = op::PCapDumper::splitHost;
+                } else if (!::strcmp(value, "connection")) {
+                    mOutput.mSplit = op::PCapDumper::splitConnection;
+                } else {
+                    std::cerr << "ERR: unknown split '" << value << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+            } else if (!::strcmp(argv[i], "--max-open-files") && i + 1 < argc) {
+                unsigned n;
+                if (!parseCount(argv[++i], n) || n == 0) {
+                    std::cerr << "ERR: bad number of files '" << argv[i] << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                mOutput.mMaxOpen = n;
+            } else if (!::strcmp(argv[i], "--compress") && i + 1 < argc) {
+                std::string value = argv[++i];
+                size_t colon = value.find(':');
+                std::string name = value.substr(0, colon);
+                bool zstd = (name == "zstd");
+                unsigned level = (zstd ? 3 : 6);
+                bool ok = (colon == std::string::npos || parseCount(value.c_str() + colon + 1, level));
+                if (!ok || (name != "gzip" && !zstd) || level < 1 || level > (zstd ? 22u : 9u)) {
+                    std::cerr << "ERR: unknown compression '" << value << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                mOutput.mCompression = (zstd ? op::FileFinisher::cmpZstd : op::FileFinisher::cmpGzip);
+                mOutput.mCompressionLevel = (int) level;
+                if (!op::FileFinisher::isSupported(mOutput.mCompression)) {
+                    std::cerr << "ERR: " << name << " isn't supported, built without "
+                              << (zstd ? "libzstd." : "zlib.") << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+            } else if (!::strcmp(argv[i], "--offline")) {
+                mOutput.mOffline = true;
+            } else if (!::strcmp(argv[i], "--checksum") && i + 1 < argc) {
+                const char * value = argv[++i];
+                const op::CHECKSUM impls[] = { op::csumNone, op::csumAuto, op::csumScalar,
+                                               op::csumSSE2, op::csumAVX2 };
+                size_t k = 0;
+                while (k < 5 && ::strcmp(value, op::checksumName(impls[k]))) ++k;
+                if (k == 5) {
+                    std::cerr << "ERR: unknown checksum '" << value << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                mOutput.mChecksum = impls[k];
+            } else if (!::strcmp(argv[i], "--format") && i + 1 < argc) {
+                const char * value = argv[++i];
+                if (!::strcmp(value, "pcap")) {
+                    mOutput.mFormat = op::PCapDumper::fmtPcap;
+                } else if (!::strcmp(value, "pcapng")) {
+                    mOutput.mFormat = op::PCapDumper::fmtPcapNG;
+                } else {
+                    std::cerr << "ERR: unknown format '" << value << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+            } else if (!::strcmp(argv[i], "--type") && i + 1 < argc) {
+                std::vector<std::string> items = splitList(argv[++i]);
+                for (size_t k = 0; k < items.size(); ++k) mFilter.addType(items[k]);
+            } else if (!::strcmp(argv[i], "--host") && i + 1 < argc) {
+                std::vector<std::string> items = splitList(argv[++i]);
+                for (size_t k = 0; k < items.size(); ++k) mFilter.addHost(items[k]);
+            } else if (!::strcmp(argv[i], "--method") && i + 1 < argc) {
+                std::vector<std::string> items = splitList(argv[++i]);
+                for (size_t k = 0; k < items.size(); ++k) mFilter.addMethod(items[k]);
+            } else if (!::strcmp(argv[i], "--status") && i + 1 < argc) {
+                std::vector<std::string> items = splitList(argv[++i]);
+                size_t k = 0;
+                while (k < items.size() && mFilter.addStatus(items[k])) ++k;
+                if (k < items.size()) {
+                    std::cerr << "ERR: bad status '" << items[k] << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+            } else if ((!::strcmp(argv[i], "--since") || !::strcmp(argv[i], "--until")) && i + 1 < argc) {
+                bool since = !::strcmp(argv[i], "--since");
+                int64_t ns;
+                if (!op::FlowFilter::parseTime(argv[++i], ns)) {
+                    std::cerr << "ERR: bad time '" << argv[i] << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                if (since) mFilter.setSince(ns); else mFilter.setUntil(ns);
+            } else if (!::strcmp(argv[i], "--index")) {
+                mIndex = true;
+            } else if (!::strcmp(argv[i], "--temp-dir") && i + 1 < argc) {
+                mTempDir = argv[++i];
+            } else if (!::strcmp(argv[i], "--threads") && i + 1 < argc) {
+                if (!parseCount(argv[++i], mThreads)) {
+                    std::cerr << "ERR: bad number of threads '" << argv[i] << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                if (mThreads == 0) mThreads = op::hardwareThreads();
+            } else if (!::strcmp(argv[i], "--jobs") && i + 1 < argc) {
+                if (!parseCount(argv[++i], mJobs)) {
+                    std::cerr << "ERR: bad number of jobs '" << argv[i] << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                if (mJobs == 0) mJobs = op::hardwareThreads();
+            } else if (!::strcmp(argv[i], "--output-dir") && i + 1 < argc) {
+                mOutputDir = argv[++i];
+            } else if (!::strcmp(argv[i], "--merge")) {
+                mMerge = true;
+            } else if (!::strcmp(argv[i], "--output") && i + 1 < argc) {
+                mOutputFile = argv[++i];
+            } else if (!::strcmp(argv[i], "--follow")) {
+                mFollow = true;
+            } else if (!::strcmp(argv[i], "-") && !mInputPaths.empty()) {
+                // stdout is output of inputs given before
+                mOutputFile = argv[i];
+            } else if (isDirectory(argv[i])) {
+                if (!listFlowFiles(argv[i], mInputPaths)) {
+                    std::cerr << "ERR: can't read directory '" << argv[i] << "'" << std::endl;
+                    mBadOption = true;
+                    break;
+                }
+                mDump = true;
             } else {
-                mInputPath = argv[i];
+                mInputPaths.push_back(argv[i]);
                 mDump = true;
             }
         }
+        if (!mBadOption && mOutput.mSplit != op::PCapDumper::splitNone &&
+            mOutput.mRotation.enabled()) {
+            std::cerr << "ERR: split output isn't rotated." << std::endl;
+            mBadOption = true;
+        }
+        if (!mBadOption && !checkLive()) {
+            mBadOption = true;
+        }
+        if (mBadOption) mInputPaths.clear();
         // if input path not specifed then show usage message
-        mShowUsage = mInputPath.empty();
+        mShowUsage = mInputPaths.empty();
+        // usage is asked or nothing is given
+        mUsageOnly = mShowUsage && !mBadOption && (help || argc == 1);
+    }
+
+    // stdin is read once and stdout gets one file, live input is
+    // converted by one pass
+    bool checkLive() const {
+        size_t stdinInputs = std::count(mInputPaths.begin(), mInputPaths.end(), "-");
+        if (stdinInputs > 1) {
+            std::cerr << "ERR: stdin is read only once." << std::endl;
+            return false;
+        }
+        if (!mOutputFile.empty() && mInputPaths.size() > 1 && !mMerge) {
+            std::cerr << "ERR: --output is output of single input or of --merge." << std::endl;
+            return false;
+        }
+        if (mOutputFile == "-" || (stdinInputs != 0 && mOutputFile.empty() && !mMerge)) {
+            if (mOutput.mSplit != op::PCapDumper::splitNone || mOutput.mRotation.enabled() ||
+                mOutput.mCompression == op::FileFinisher::cmpGzip) {
+                std::cerr << "ERR: output to stdout isn't split, rotated or gzipped." << std::endl;
+                return false;
+            }
+        }
+        if (mFollow && (mInputPaths.size() != 1 || mMerge || mMaxMemory != 0 || mIndex)) {
+            std::cerr << "ERR: --follow converts single input through reorder window." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // input file name with extension of output format, in output directory
+    // if it's given; --output or stdout for stdin
+    std::string outputPath(const std::string & inPath) const {
+        if (!mOutputFile.empty())
+            return mOutputFile;
+        if (inPath == "-")
+            return inPath;
+        std::string path = inPath;
+        if (!mOutputDir.empty()) {
+            size_t slash = inPath.find_last_of("/\\");
+            path = mOutputDir + "/" + (slash == std::string::npos ? inPath : inPath.substr(slash + 1));
+        }
+        return path + (mOutput.mFormat == op::PCapDumper::fmtPcapNG ? ".pcapng" : ".pcap");
+    }
+
+    // output of merged inputs
+    std::string mergedPath() const {
+        if (!mOutputFile.empty())
+            return mOutputFile;
+        return outputPath(mOutputDir.empty() ? "merged" : mOutputDir + "/merged");
     }
 
     ~CommandOptions() {
@@ -195,17 +1056,128 @@ struct CommandOptions {
     }
 }; // CommandOptions
 
+// convert or print one input file
+bool convertFile(const CommandOptions & cmdOptions, const std::string & inPath,
+                 const OutputOptions & output) {
+    std::string outPath = cmdOptions.outputPath(inPath);
+    if ((cmdOptions.mMaxMemory != 0 || cmdOptions.mIndex) && !cmdOptions.mPrint) {
+        // events are kept in memory up to 1G when limit isn't given
+        size_t maxMemory = (cmdOptions.mMaxMemory ? cmdOptions.mMaxMemory : (size_t) 1 << 30);
+        return sortFlows(inPath, outPath, output, cmdOptions.mFilter, maxMemory,
+                         cmdOptions.mTempDir, cmdOptions.mIndex);
+    }
+    bool live = cmdOptions.mFollow || inPath == "-";
+    if ((cmdOptions.mStream || live) && !cmdOptions.mPrint) {
+        // live input goes through window of 1000 events when it isn't given
+        size_t windowCount = (cmdOptions.mStream ? cmdOptions.mWindowCount : 1000);
+        return streamFlows(inPath, outPath, output, cmdOptions.mFilter,
+                           windowCount, cmdOptions.mWindowSpan, cmdOptions.mFollow);
+    }
+    op::MFlowParser parsedFlows;
+    parsedFlows.setThreads(cmdOptions.mThreads);
+    parsedFlows.setFilter(cmdOptions.mFilter.empty() ? nullptr : &cmdOptions.mFilter);
+    if (!cmdOptions.mPrint) {
+        // --print shows whole flows
+        parsedFlows.setProjection(&op::eventProjection());
+    }
+    if (!parsedFlows.parseFile(inPath)) {
+        std::cerr << "ERR: " << parsedFlows.errorString() << std::endl;
+        return false;
+    }
+    if (parsedFlows.isError()) {
+        std::cerr << "WARN: " << parsedFlows.errorString() << std::endl;
+    }
+    if (cmdOptions.mStats) {
+        size_t allocations, blocks, bytes;
+        parsedFlows.arenaStats(allocations, blocks, bytes);
+        std::cerr << "flows: " << parsedFlows.itemsVec().size()
+                  << ", allocations: " << allocations
+                  << ", heap blocks: " << blocks
+                  << ", bytes: " << bytes << std::endl;
+    }
+    if (cmdOptions.mPrint) {
+        parsedFlows.rootItem()->print(std::cout);
+    } else if (cmdOptions.mDump) {
+        return dumpFlows(parsedFlows, outPath, output, cmdOptions.mThreads);
+    }
+    return true;
+}
+
+// merge all input files into one output
+bool mergeFiles(const CommandOptions & cmdOptions) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    FileSummary summary;
+    OutputOptions output = cmdOptions.mOutput;
+    output.mSummary = &summary;
+    // events are kept in memory up to 1G when limit isn't given
+    size_t maxMemory = (cmdOptions.mMaxMemory ? cmdOptions.mMaxMemory : (size_t) 1 << 30);
+    std::string outPath = cmdOptions.mergedPath();
+    if (!mergeFlows(cmdOptions.mInputPaths, outPath, output, cmdOptions.mFilter, maxMemory,
+                    cmdOptions.mTempDir, cmdOptions.mIndex, cmdOptions.mJobs))
+        return false;
+    if (cmdOptions.mStats) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "merged " << cmdOptions.mInputPaths.size() << " files into " << outPath << ": "
+                  << summary.mPackets << " packets, " << summary.mBytes << " bytes in "
+                  << seconds << " s" << std::endl;
+    }
+    return true;
+}
+
+// convert input files on `jobs` workers, each of them has own parser
+// and dumper; summary is printed when there are several files
+bool convertFiles(const CommandOptions & cmdOptions) {
+    if (cmdOptions.mMerge && !cmdOptions.mPrint)
+        return mergeFiles(cmdOptions);
+    const std::vector<std::string> & inputs = cmdOptions.mInputPaths;
+    std::vector<FileSummary> summary(inputs.size());
+    struct Job {
+        const CommandOptions & mOptions;
+        std::vector<FileSummary> & mSummary;
+        void operator()(size_t i, unsigned) const {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            OutputOptions output = mOptions.mOutput;
+            output.mSummary = &mSummary[i];
+            mSummary[i].mOK = convertFile(mOptions, mOptions.mInputPaths[i], output);
+            mSummary[i].mSeconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+    } job = { cmdOptions, summary };
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    // printed flows aren't mixed
+    unsigned jobs = (cmdOptions.mPrint ? 1 : cmdOptions.mJobs);
+    op::parallelFor(std::min<size_t>(jobs, inputs.size()), inputs.size(), job);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t converted = 0;
+    uint64_t packets = 0, bytes = 0;
+    for (size_t i = 0; i < summary.size(); ++i) {
+        if (summary[i].mOK) {
+            ++converted;
+            packets += summary[i].mPackets;
+            bytes += summary[i].mBytes;
+        }
+    }
+    if (inputs.size() > 1 && !cmdOptions.mPrint) {
+        for (size_t i = 0; i < summary.size(); ++i) {
+            if (!summary[i].mOK)
+                std::cerr << "FAILED: " << inputs[i] << std::endl;
+            else if (cmdOptions.mStats)
+                std::cerr << inputs[i] << ": " << summary[i].mPackets << " packets, "
+                          << summary[i].mBytes << " bytes, " << summary[i].mSeconds << " s" << std::endl;
+        }
+        std::cerr << "converted " << converted << " of " << inputs.size() << " files: "
+                  << packets << " packets, " << bytes << " bytes in " << seconds << " s"
+                  << std::endl;
+    }
+    return converted == inputs.size();
+}
+
 // entry point of application
 int main(int argc, char** argv) {
     CommandOptions cmdOptions(argc, argv);
     if (!cmdOptions.mShowUsage) {
-        op::MFlowParser parsedFlows;
-        std::ifstream is(cmdOptions.mInputPath.c_str(), std::ifstream::binary);
-        parsedFlows.parse(is);
-        if (cmdOptions.mPrint) {
-            parsedFlows.rootItem()->print(std::cout);
-        } else if (cmdOptions.mDump) {
-            dumpFlows(parsedFlows, cmdOptions.mInputPath + ".pcap");
-        }
+        return convertFiles(cmdOptions) ? 0 : 1;
     }
+    return cmdOptions.mUsageOnly ? 0 : 1;
 } // main
@@ -18,17 +18,51 @@
 #pragma once
 
 #include "variant.hpp"
+#include "projection.hpp"
+#include "mappedfile.hpp"
+#include "inputbuffer.hpp"
+#include "threadpool.hpp"
 #include <sstream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <new>
 #include <stdexcept>
 
 namespace op {
 
+/*
+ * Predicate checked before record is parsed whole: record is parsed with
+ * projection() first, which should take few small values of it, and it's
+ * left out unless accept() of that tree is true.
+ */
+
+class RecordFilter {
+public:
+    virtual ~RecordFilter() {}
+    virtual const Projection & projection() const = 0;
+    virtual bool accept(VariantPtr head) const = 0;
+}; // RecordFilter
+
 /*
  * Class with example how to parse netstrings serialization method.
  */
 
 class MFlowParser {
 public:
+    MFlowParser()
+        : mStream(&mInputBuffer)
+        , mIs(nullptr)
+        , mBase(nullptr)
+        , mPos(nullptr)
+        , mEnd(nullptr)
+        , mStreamOffset(0)
+        , mFollow(false)
+        , mThreads(1)
+        , mRoot(nullptr)
+        , mProjection(nullptr)
+        , mFilter(nullptr)
+    {}
 
     template <class T>
     static const VariantPtr At(const KeyValueMap & map, const T & k) {
@@ -63,85 +97,102 @@ public:
 
     // /////////////////////////////////////////////////////////////////// //
 
-    char popStr(const char *& pBegin, const char * pEnd, std::string & buffer) {
-        buffer.clear();
-        char slen[10];
-        size_t len = 0;
+    // length of netstring has not more digits, so it doesn't overflow
+    enum { MAX_LENGTH_DIGITS = 9 };
+
+    // pop netstring from [pBegin, pEnd) without copying its data: on return
+    // [pData, pData + len) points to the value inside of the source buffer;
+    // 'E' with pBegin at pEnd when data doesn't fit, before it when it's broken
+    static char popStr(const char *& pBegin, const char * pEnd, const char *& pData, size_t & len) {
         // read data length
+        const char * pDigits = pBegin;
         len = 0;
-        while (len < sizeof(slen)-1) {
-            if (pBegin >= pEnd) return 'E';
-            slen[len] = *pBegin++;
-            if (!::isdigit(slen[len])) break;
-            ++len;
+        while (pBegin < pEnd && ::isdigit(*pBegin) && pBegin - pDigits < MAX_LENGTH_DIGITS) {
+            len = len * 10 + (*pBegin++ - '0');
         }
-        slen[len] = '\0';
 
         // nothing?
-        if (len == 0) return 'E';
-
-        len = atoi(slen);
-
-//        std::cerr << "LEN = " << len << std::endl;
-
-        // read data
-        buffer = std::string(pBegin, len);
+        if (pBegin == pDigits || pBegin >= pEnd) return 'E';
+        if (*pBegin != ':') return 'E';
+        ++pBegin; // skip ':'
+
+        // data and its type must fit into the buffer
+        if ((size_t) (pEnd - pBegin) <= len) {
+            pBegin = pEnd;
+            return 'E';
+        }
+        pData = pBegin;
         pBegin += len;
-        assert (pBegin < pEnd);
-
-//        std::cerr << "DATA = " << buffer << std::endl;
 
         // read data type
-        *slen = '\0';
-        *slen = *pBegin++;
-        assert (pBegin <= pEnd);
-
-//        std::cerr << "DTYPE = " << *slen << std::endl;
-
-        return *slen;
+        return *pBegin++;
     }
 
     /*
-     *
+     * Nested maps and vectors are parsed in place over the same source
+     * buffer, so each byte of input is visited once whatever the depth.
+     * Values of map not needed by node `proj` of projection are stepped over by
+     * their length and never tokenized.
      */
 
-    const char *  parseVector(const char * pBegin, const char * pEnd, ValuesVector & vec) {
-//        std::cerr << "PARSE VEC" << std::endl;
-        std::string buffer;
+    // strings of mapped input or memory given to parse() are referred to
+    // in place, ones read from stream are copied into arena
+    bool copyStrings() const {
+        return mIs != nullptr;
+    }
+    VariantPtr makeString(Arena & arena, const char * pData, size_t len) const {
+        return copyStrings() ? Variant::make(arena, pData, (unsigned) len)
+                             : Variant::makeRef(arena, pData, (unsigned) len);
+    }
+    // number or boolean; malformed one (e.g. integer out of int64 range)
+    // is kept as string
+    VariantPtr makeScalar(Arena & arena, char dataType, const char * pData, size_t len) const {
+        const char * text = (copyStrings() ? arena.copy(pData, len) : pData);
+        VariantPtr var = Variant::parse(arena, dataType, text, (unsigned) len);
+        return (var != nullptr ? var : makeString(arena, pData, len));
+    }
+
+    // number of netstrings in [pBegin, pEnd), nested ones aren't visited
+    static size_t countItems(const char * pBegin, const char * pEnd) {
+        const char * pData;
+        size_t len, count = 0;
+        while (pBegin < pEnd && popStr(pBegin, pEnd, pData, len) != 'E') {
+            ++count;
+        }
+        return count;
+    }
+
+    const char * parseVector(Arena & arena, const char * pBegin, const char * pEnd, ValuesVector & vec,
+                             const Projection * projection = nullptr, int proj = Projection::ALL) const {
+        const char * pData;
+        size_t len;
+        vec.reserve(arena, countItems(pBegin, pEnd));
         while (pBegin < pEnd) {
-            char dataType = popStr(pBegin, pEnd, buffer);
+            char dataType = popStr(pBegin, pEnd, pData, len);
+            if (dataType == 'E')
+                break;
 
             switch (dataType) {
             case ',':
             case ';':
-            case '!':
-            case '#':
-            case '^':
             case '~':
-                vec.push_back(Variant::make(buffer.c_str(), buffer.length()));
+                vec.push_back(arena, makeString(arena, pData, len));
                 break;
-#if (0)
-            // TODO: enable parsing of this data types
             case '!':
-                vec.push_back(Variant::make((int64_t) !buffer.compare("true")));
-                break;
             case '#':
-                vec.push_back(Variant::make(atoi(buffer.c_str())));
-                break;
             case '^':
-                vec.push_back(Variant::make(atof(buffer.c_str())));
+                vec.push_back(arena, makeScalar(arena, dataType, pData, len));
                 break;
-#endif
             case '}': {
-                VariantPtr newMap = Variant::makeMap();
-                parseMap(buffer.c_str(), buffer.c_str() + buffer.length(), newMap->asMap());
-                vec.push_back(newMap);
+                VariantPtr newMap = Variant::makeMap(arena);
+                parseMap(arena, pData, pData + len, newMap->asMap(), projection, proj);
+                vec.push_back(arena, newMap);
                 break;
             }
             case ']': {
-                VariantPtr newVec = Variant::makeRepeated();
-                parseVector(buffer.c_str(), buffer.c_str() + buffer.length(), newVec->asVector());
-                vec.push_back(newVec);
+                VariantPtr newVec = Variant::makeRepeated(arena);
+                parseVector(arena, pData, pData + len, newVec->asVector(), projection, proj);
+                vec.push_back(arena, newVec);
                 break;
             }
             default:
@@ -152,60 +203,58 @@ public:
         return pBegin;
     }
 
-    const char * parseMap(const char * pBegin, const char * pEnd, KeyValueMap & node) {
-//        std::cerr << "PARSE MAP" << std::endl;
-        std::string k, v;
+    const char * parseMap(Arena & arena, const char * pBegin, const char * pEnd, KeyValueMap & node,
+                          const Projection * projection = nullptr, int proj = Projection::ALL) const {
+        const char * pKey, * pData;
+        size_t keyLen, len;
         char dataType;
+        if (proj == Projection::ALL)
+            node.reserve(arena, countItems(pBegin, pEnd) / 2);
         while (pBegin < pEnd) {
-            dataType = popStr(pBegin, pEnd, k);
+            dataType = popStr(pBegin, pEnd, pKey, keyLen);
             if (dataType == 'E')
                 break;
 
             assert(dataType == ';');
-            dataType = popStr(pBegin, pEnd, v);
+            dataType = popStr(pBegin, pEnd, pData, len);
+            if (dataType == 'E')
+                break;
 
-            //assert(dataType == ';');
+            int sub = (proj == Projection::ALL ? proj
+                                               : projection->child(proj, StringRef(pKey, keyLen)));
+            if (sub == Projection::SKIP)
+                continue;
 
+            VariantPtr v = nullptr;
             switch (dataType) {
             case ',':
             case ';':
-            case '!':
-            case '#':
-            case '^':
             case '~':
-                node[k] = Variant::make(v.c_str(), v.length());
+                v = makeString(arena, pData, len);
                 break;
-#if (0)
-            // TODO: enable parsing of this types
             case '!':
-                node[k] = Variant::make((int32_t) !v.compare("true"));
-                break;
             case '#':
-                node[k] = Variant::make(atoi(v.c_str()));
-                break;
             case '^':
-                node[k] = Variant::make(atof(v.c_str()));
+                v = makeScalar(arena, dataType, pData, len);
                 break;
-#endif
             case '}': {
-                VariantPtr newMap = Variant::makeMap();
-                node[k] = newMap;
-                parseMap(v.c_str(), v.c_str() + v.length(), newMap->asMap());
-                //pBegin += v.length();
+                v = Variant::makeMap(arena);
+                parseMap(arena, pData, pData + len, v->asMap(), projection, sub);
                 break;
             }
             case ']': {
-                VariantPtr newVec = Variant::makeRepeated();
-                node[k] = newVec;
-                parseVector(v.c_str(), v.c_str() + v.length(), newVec->asVector());
-                //pBegin += v.length();
+                v = Variant::makeRepeated(arena);
+                parseVector(arena, pData, pData + len, v->asVector(), projection, sub);
                 break;
             }
             default:
                 assert(!"unk");
                 break;
             }
+            if (v != nullptr)
+                node.append(arena, StringRef(copyStrings() ? arena.copy(pKey, keyLen) : pKey, keyLen), v);
         }
+        node.finish();
         return pBegin;
     }
 
@@ -214,15 +263,15 @@ public:
         while (pBegin < pEnd) {
             switch (dataType) {
             case '}': {
-                VariantPtr newMap = Variant::makeMap();
-                pBegin = parseMap(pBegin, pEnd, newMap->asMap());
-                vec.push_back(newMap);
+                VariantPtr newMap = Variant::makeMap(mArena);
+                pBegin = parseMap(mArena, pBegin, pEnd, newMap->asMap());
+                vec.push_back(mArena, newMap);
                 break;
             }
             case ']': {
-                VariantPtr newVector = Variant::makeRepeated();
-                pBegin = parseVector(pBegin, pEnd, newVector->asVector());
-                vec.push_back(newVector);
+                VariantPtr newVector = Variant::makeRepeated(mArena);
+                pBegin = parseVector(mArena, pBegin, pEnd, newVector->asVector());
+                vec.push_back(mArena, newVector);
                 break;
             }
             default: break;
@@ -230,45 +279,276 @@ public:
         }
     }
 
-    void parse(std::istream & is) {
-        std::string buffer;
-        char slen[10];
-        size_t len = 0;
-
-        mRoot = Variant::makeRepeated();
-        for (;;) {
-            // read data length
-            len = 0;
-            while (len < sizeof(slen)-1) {
-                is.read(slen + len, 1);
-                if (is.eof() || !::isdigit(slen[len])) break;
-                ++len;
+    // /////////////////////////////////////////////////////////////////// //
+
+    /*
+     * Top-level records of input could be read and parsed one by one:
+     * open() input and call nextRecord() until it returns false.
+     */
+
+    struct Record {
+        const char * mData;  // valid until next call of nextRecord()
+        size_t mLength;
+        char mType;
+        uint64_t mOffset;    // position of record in input
+        size_t mPrefix;      // bytes of its length and ':' before data
+    };
+
+    // map file in memory or open it as stream if it isn't regular file,
+    // it's compressed or followed; "-" is standard input; returns false
+    // if file can't be opened
+    bool open(const std::string & path) {
+        reset();
+        if (!mFollow && path != "-" && MappedFile::isRegular(path) && mInput.open(path)) {
+            if (InputBuffer::detect(mInput.begin(), mInput.size()) == InputBuffer::codecNone) {
+                mBase = mPos = mInput.begin();
+                mEnd = mInput.end();
+                return true;
             }
-            slen[len] = '\0';
+            mInput.close();
+        }
+        if (!mInputBuffer.open(path)) {
+            mError = mInputBuffer.errorString();
+            return false;
+        }
+        mIs = &mStream;
+        return true;
+    }
+    void open(const char * pBegin, const char * pEnd) {
+        reset();
+        mBase = mPos = pBegin;
+        mEnd = pEnd;
+    }
+    void open(std::istream & is) {
+        reset();
+        mIs = &is;
+    }
+
+    bool nextRecord(Record & rec) {
+        if (mIs != nullptr) {
+            if (readRecord(rec))
+                return true;
+            if (!mInputBuffer.errorString().empty())
+                mError = mInputBuffer.errorString();
+            return false;
+        }
+        if (mPos >= mEnd)
+            return false;
+        const char * pRecord = mPos;
+        rec.mType = popStr(mPos, mEnd, rec.mData, rec.mLength);
+        if (rec.mType == 'E') {
+            if (mPos == mEnd && ::isdigit(*pRecord))
+                mError = "truncated record at the end of input.";
+            else if (::isdigit(*pRecord))
+                corruptAt(pRecord - mBase);
+            mPos = mEnd;
+            return false;
+        }
+        rec.mOffset = pRecord - mBase;
+        rec.mPrefix = rec.mData - pRecord;
+        return true;
+    }
+
+    /*
+     * Input read as stream calls idle when all its data which is ready
+     * is parsed. follow - file is growing, its records are read as they
+     * are appended until idle returns false. It's set before open().
+     */
+    void setIdle(InputIdle * idle, bool follow = false) {
+        mInputBuffer.setIdle(idle, follow);
+        mFollow = follow && idle != nullptr;
+    }
+
+    // input is mapped in memory and records could be got by offset
+    bool isMapped() const {
+        return mIs == nullptr && mBase != nullptr;
+    }
+
+    bool recordAt(uint64_t offset, Record & rec) const {
+        assert(isMapped());
+        const char * pBegin = mBase + offset;
+        if (pBegin >= mEnd)
+            return false;
+        rec.mType = popStr(pBegin, mEnd, rec.mData, rec.mLength);
+        rec.mOffset = offset;
+        rec.mPrefix = rec.mData - (mBase + offset);
+        return rec.mType != 'E';
+    }
+
+    // record whose place is known, e.g. from index, its length isn't parsed
+    bool recordAt(uint64_t offset, size_t prefix, size_t length, Record & rec) const {
+        assert(isMapped());
+        if (offset + prefix + length >= (uint64_t) (mEnd - mBase))
+            return false;
+        rec.mData = mBase + offset + prefix;
+        rec.mLength = length;
+        rec.mType = rec.mData[length];
+        rec.mOffset = offset;
+        rec.mPrefix = prefix;
+        return true;
+    }
+
+    // build tree of record in arena, returns nullptr for non-container records
+    VariantPtr parseRecord(const Record & rec, Arena & arena) const {
+        return parseRecord(rec, arena, mProjection);
+    }
+    VariantPtr parseRecord(const Record & rec, Arena & arena, const Projection * projection) const {
+        const char * pBegin = rec.mData;
+        const char * pEnd = rec.mData + rec.mLength;
+        int proj = (projection != nullptr ? projection->root() : (int) Projection::ALL);
+        switch (rec.mType) {
+        case '}': {
+            VariantPtr newMap = Variant::makeMap(arena);
+            parseMap(arena, pBegin, pEnd, newMap->asMap(), projection, proj);
+            return newMap;
+        }
+        case ']': {
+            VariantPtr newVector = Variant::makeRepeated(arena);
+            parseVector(arena, pBegin, pEnd, newVector->asVector(), projection, proj);
+            return newVector;
+        }
+        default:
+            return nullptr;
+        }
+    }
 
-            // nothing?
-            if (len == 0) break;
+    // record passes filter, tree used to check it is left in arena
+    bool accept(const Record & rec, Arena & arena) const {
+        return mFilter == nullptr ||
+               mFilter->accept(parseRecord(rec, arena, &mFilter->projection()));
+    }
 
-            len = atoi(slen);
-//            std::cerr << len << std::endl;
+    // parseRecord() of record which passes filter or nullptr
+    VariantPtr parseSelected(const Record & rec, Arena & arena) const {
+        return accept(rec, arena) ? parseRecord(rec, arena) : nullptr;
+    }
 
-            // read data
-            buffer.resize(len);
-            char * ptr = (char*) buffer.data();
-            is.read(ptr, len);
-            ptr[len] = '\0';
-//            std::cerr << ptr << std::endl;
+    // parse all records of file into rootItem()
+    bool parseFile(const std::string & path) {
+        if (!open(path))
+            return false;
+        parseRecords();
+        return true;
+    }
 
-            // read data type
-            *slen = '\0';
-            is.read(slen, 1);
+    // parse top-level netstrings laying in memory, parsed strings refer
+    // to it, so it must outlive parser
+    void parse(const char * pBegin, const char * pEnd) {
+        open(pBegin, pEnd);
+        parseRecords();
+    }
+
+    void parse(std::istream & is) {
+        open(is);
+        parseRecords();
+    }
 
-            // parse
-            parse(ptr, ptr + buffer.size(), *slen, mRoot->asVector());
+private:
+    void reset() {
+        mError.clear();
+        mInput.close();
+        mInputBuffer.close();
+        mStream.clear();
+        mIs = nullptr;
+        mBase = mPos = mEnd = nullptr;
+        mStreamOffset = 0;
+    }
+
+    void parseRecords() {
+        Record rec;
+        mArena.clear();
+        mWorkerArenas.clear();
+        mRoot = Variant::makeRepeated(mArena);
+        if (mThreads > 1 && isMapped()) {
+            parseRecordsParallel();
+            return;
+        }
+        while (nextRecord(rec)) {
+            VariantPtr item = parseSelected(rec, mArena);
+            if (item != nullptr)
+                mRoot->asVector().push_back(mArena, item);
         }
     }
 
-    // /////////////////////////////////////////////////////////////////// //
+    // records are framed first, then parsed by workers into their own
+    // arenas and put into root in the original order
+    void parseRecordsParallel() {
+        std::vector<Record> records;
+        Record rec;
+        while (nextRecord(rec)) {
+            records.push_back(rec);
+        }
+        for (unsigned w = 0; w < mThreads; ++w) {
+            mWorkerArenas.push_back(std::unique_ptr<Arena>(new Arena()));
+        }
+        std::vector<VariantPtr> items(records.size());
+        struct Task {
+            MFlowParser & mParser;
+            std::vector<Record> & mRecords;
+            std::vector<VariantPtr> & mItems;
+            void operator()(size_t i, unsigned worker) {
+                mItems[i] = mParser.parseSelected(mRecords[i], *mParser.mWorkerArenas[worker]);
+            }
+        } task = { *this, records, items };
+        parallelFor(mThreads, records.size(), task, 16);
+
+        ValuesVector & vec = mRoot->asVector();
+        vec.reserve(mArena, items.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (items[i] != nullptr)
+                vec.push_back(mArena, items[i]);
+        }
+    }
+
+    void corruptAt(uint64_t offset) {
+        std::ostringstream os;
+        os << "corrupt record at offset " << offset << " of input.";
+        mError = os.str();
+    }
+
+    bool readRecord(Record & rec) {
+        std::istream & is = *mIs;
+        char ch = 0;
+        size_t len = 0, digits = 0;
+
+        // read data length
+        rec.mOffset = mStreamOffset;
+        while (digits <= MAX_LENGTH_DIGITS && is.get(ch) && ::isdigit(ch)) {
+            len = len * 10 + (ch - '0');
+            ++digits;
+        }
+        // nothing?
+        if (digits == 0) return false;
+        if (!is) {
+            mError = "truncated record at the end of input.";
+            return false;
+        }
+        if (digits > MAX_LENGTH_DIGITS || ch != ':') {
+            corruptAt(mStreamOffset);
+            return false;
+        }
+
+        // read data and its type
+        try {
+            mRecordBuffer.resize(len + 1);
+        } catch (const std::bad_alloc &) {
+            std::ostringstream os;
+            os << "no memory for record of " << len << " bytes at offset " << mStreamOffset << ".";
+            mError = os.str();
+            return false;
+        }
+        is.read(&mRecordBuffer[0], len + 1);
+        if ((size_t) is.gcount() != len + 1) {
+            mError = "truncated record at the end of input.";
+            return false;
+        }
+        mStreamOffset += digits + 1 + len + 1;
+        rec.mData = mRecordBuffer.data();
+        rec.mLength = len;
+        rec.mPrefix = digits + 1;
+        rec.mType = mRecordBuffer[len];
+        return true;
+    }
 
 public:
 
@@ -279,8 +559,53 @@ public:
         return mError;
     }
 
+    // number of threads for parseFile(), records of mapped input are
+    // parsed in parallel when it's more than one
+    void setThreads(unsigned threads) {
+        mThreads = (threads ? threads : 1);
+    }
+
+    // only paths of projection are parsed from records, whole records are
+    // parsed when it's nullptr; projection must outlive parser
+    void setProjection(const Projection * projection) {
+        mProjection = projection;
+    }
+
+    // records are parsed into rootItem() and by parseSelected() only when
+    // they pass filter; filter must outlive parser
+    void setFilter(const RecordFilter * filter) {
+        mFilter = filter;
+    }
+
+    // memory where parsed tree lives
+    void arenaStats(size_t & allocations, size_t & blocks, size_t & bytes) const {
+        allocations = mArena.allocations();
+        blocks = mArena.blocks();
+        bytes = mArena.bytesReserved();
+        for (size_t w = 0; w < mWorkerArenas.size(); ++w) {
+            allocations += mWorkerArenas[w]->allocations();
+            blocks += mWorkerArenas[w]->blocks();
+            bytes += mWorkerArenas[w]->bytesReserved();
+        }
+    }
+
 private:
+    MappedFile mInput;
+    InputBuffer mInputBuffer;
+    std::istream mStream;       // reads mInputBuffer
+    std::istream * mIs;
+    const char * mBase;
+    const char * mPos;
+    const char * mEnd;
+    uint64_t mStreamOffset;
+    bool mFollow;
+    std::string mRecordBuffer;
+    Arena mArena;
+    std::vector<std::unique_ptr<Arena> > mWorkerArenas;
+    unsigned mThreads;
     VariantPtr mRoot;
+    const Projection * mProjection;
+    const RecordFilter * mFilter;
     std::string mError;
 }; // MitmProxyFlow
 
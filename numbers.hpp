@@ -0,0 +1,141 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <locale>
+#include <stdint.h>
+
+namespace op {
+
+/*
+ * Parsers of numbers in text of [pBegin, pEnd) in the way of from_chars():
+ * no allocation, no locale, whole text must be a number. They return
+ * false leaving value untouched if it isn't.
+ */
+
+// "-123" -> -123, overflow isn't accepted
+inline bool parseInt(const char * p, const char * pEnd, int64_t & value) {
+    bool negative = (p != pEnd && *p == '-');
+    if (negative) ++p;
+    if (p == pEnd)
+        return false;
+    uint64_t v = 0;
+    for (; p != pEnd; ++p) {
+        unsigned digit = (unsigned) (*p - '0');
+        if (digit > 9 || v > (UINT64_C(0xFFFFFFFFFFFFFFFF) - digit) / 10)
+            return false;
+        v = v * 10 + digit;
+    }
+    if (v > (uint64_t) INT64_MAX + (negative ? 1 : 0))
+        return false;
+    value = (negative ? (int64_t) (0 - v) : (int64_t) v);
+    return true;
+}
+
+// "1539083574.123456789" -> nanoseconds, digits after ninth are dropped;
+// exponent and values out of int64_t nanoseconds aren't accepted
+inline bool parseNanos(const char * p, const char * pEnd, int64_t & ns) {
+    bool negative = (p != pEnd && *p == '-');
+    if (negative) ++p;
+    const char * digits = p;
+    int64_t sec = 0;
+    for (; p != pEnd && *p >= '0' && *p <= '9'; ++p) {
+        int digit = *p - '0';
+        if (sec > (INT64_MAX / 1000000000 - digit) / 10)
+            return false;
+        sec = sec * 10 + digit;
+    }
+    if (p == digits)
+        return false;
+    int64_t frac = 0, scale = 100000000;
+    if (p != pEnd && *p == '.') {
+        for (++p; p != pEnd && *p >= '0' && *p <= '9'; ++p) {
+            frac += (*p - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (p != pEnd || frac > INT64_MAX - sec * 1000000000)
+        return false;
+    ns = sec * 1000000000 + frac;
+    if (negative) ns = -ns;
+    return true;
+}
+
+// decimal with optional fraction and exponent -> double; values with up
+// to 19 significant digits and small exponent are exact, others are
+// given to classic locale stream
+inline bool parseDouble(const char * p, const char * pEnd, double & value) {
+    static const double POW10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char * pBegin = p;
+    bool negative = (p != pEnd && *p == '-');
+    if (negative) ++p;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (; p != pEnd && *p >= '0' && *p <= '9'; ++p, any = true) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) ++digits;
+        } else {
+            ++exponent;
+        }
+    }
+    if (p != pEnd && *p == '.') {
+        for (++p; p != pEnd && *p >= '0' && *p <= '9'; ++p, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) ++digits;
+                --exponent;
+            }
+        }
+    }
+    if (!any)
+        return false;
+    if (p != pEnd && (*p == 'e' || *p == 'E')) {
+        int64_t e;
+        const char * pExp = ++p;
+        if (pExp != pEnd && *pExp == '+') ++pExp;
+        if (!parseInt(pExp, pEnd, e) || e > 100000 || e < -100000)
+            return false;
+        exponent += (int) e;
+        p = pEnd;
+    }
+    if (p != pEnd)
+        return false;
+    if (mantissa <= (UINT64_C(1) << 53) && exponent >= -22 && exponent <= 22) {
+        // both operands are exact, so is the result
+        double v = (double) mantissa;
+        v = (exponent < 0 ? v / POW10[-exponent] : v * POW10[exponent]);
+        value = (negative ? -v : v);
+        return true;
+    }
+    std::istringstream is(std::string(pBegin, pEnd));
+    is.imbue(std::locale::classic());
+    double v;
+    if (!(is >> v))
+        return false;
+    value = v;
+    return true;
+}
+
+} // namespace op
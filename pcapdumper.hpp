@@ -26,16 +26,83 @@
 #include <netdb.h>
 #endif
 
-#include <pcap/pcap.h>
+#include "bufferedfile.hpp"
+#include "filefinisher.hpp"
+#include "resolver.hpp"
+#include "conntable.hpp"
+#include "checksum.hpp"
 #include <string>
 #include <memory>
-#include <map>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <cstdio>
+
+#ifdef WIN32
+typedef unsigned char  u_int8_t;
+typedef unsigned short u_int16_t;
+typedef unsigned int   u_int32_t;
+#endif
 
 namespace op {
 
 #pragma pack(1)
+// pcap file format, see https://wiki.wireshark.org/Development/LibpcapFileFormat
+struct hdrPcapFile {
+    u_int32_t magic_number;
+    u_int16_t version_major;
+    u_int16_t version_minor;
+    int32_t   thiszone;
+    u_int32_t sigfigs;
+    u_int32_t snaplen;
+    u_int32_t network;
+};
+struct hdrPcapRecord {
+    u_int32_t ts_sec;
+    u_int32_t ts_usec;
+    u_int32_t incl_len;
+    u_int32_t orig_len;
+};
+enum {
+    LINKTYPE_RAW = 101  // raw IPv4 or IPv6 packets
+};
+
+// pcapng file format, see https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng
+enum {
+    PCAPNG_SHB = 0x0A0D0D0A,  // Section Header Block
+    PCAPNG_IDB = 0x00000001,  // Interface Description Block
+    PCAPNG_ISB = 0x00000005,  // Interface Statistics Block
+    PCAPNG_EPB = 0x00000006,  // Enhanced Packet Block
+
+    PCAPNG_OPT_END       = 0,
+    PCAPNG_OPT_COMMENT   = 1,
+    PCAPNG_SHB_USERAPPL  = 4,
+    PCAPNG_IF_TSRESOL    = 9,
+    PCAPNG_ISB_STARTTIME = 2,
+    PCAPNG_ISB_ENDTIME   = 3,
+    PCAPNG_ISB_IFRECV    = 4
+};
+struct hdrPcapngBlock {
+    u_int32_t block_type;
+    u_int32_t block_total_length;
+};
+struct hdrPcapngEPB {
+    u_int32_t block_type;
+    u_int32_t block_total_length;
+    u_int32_t interface_id;
+    u_int32_t ts_high;
+    u_int32_t ts_low;
+    u_int32_t captured_len;
+    u_int32_t original_len;
+};
+struct hdrPcapngOption {
+    u_int16_t code;
+    u_int16_t length;
+};
+
 struct hdrIPv4 {
     u_int8_t  iph_ihl:4,
               iph_ver:4;
@@ -50,7 +117,14 @@ struct hdrIPv4 {
     u_int32_t iph_sourceip;
     u_int32_t iph_destip;
 };
-// TODO: add hdrIPv6
+struct hdrIPv6 {
+    u_int32_t ip6_flow;     // version, traffic class, flow label
+    u_int16_t ip6_plen;     // payload length
+    u_int8_t  ip6_nxt;      // next header
+    u_int8_t  ip6_hlim;     // hop limit
+    u_int8_t  ip6_src[16];
+    u_int8_t  ip6_dst[16];
+};
 struct hdrTCP {
     u_int16_t tcph_srcport;
     u_int16_t tcph_destport;
@@ -73,233 +147,970 @@ struct hdrTCP {
 };
 #pragma pack()
 
+// IP and TCP headers of packets sent in one direction of connection
+struct PacketHeader {
+    u_char mData[sizeof(hdrIPv6) + sizeof(hdrTCP)];
+    u_int8_t mIPSize;       // size of IPv4 or IPv6 header
+    u_int32_t mPseudoSum;   // sum of addresses and protocol of TCP pseudo header
+};
+
+// connection in dumper
+struct TCPContext {
+    u_int32_t mReqSEQ;
+    u_int32_t mReqACK;
+    u_int32_t mRespSEQ;
+    u_int32_t mRespACK;
+    u_int32_t mPending;     // events retained but not written yet
+    u_int32_t mOutput;      // split output of connection + 1, 0 - not assigned
+    bool mReady;            // headers are built
+    PacketHeader mToSrv;
+    PacketHeader mToCli;
+
+    // TCP numbers go on when evicted connection comes back, headers and
+    // split output are made again
+    struct Kept {
+        u_int32_t mReqSEQ;
+        u_int32_t mReqACK;
+        u_int32_t mRespSEQ;
+        u_int32_t mRespACK;
+    };
+    void keep(Kept & kept) const {
+        kept.mReqSEQ  = mReqSEQ;
+        kept.mReqACK  = mReqACK;
+        kept.mRespSEQ = mRespSEQ;
+        kept.mRespACK = mRespACK;
+    }
+    void restore(const Kept & kept) {
+        mReqSEQ  = kept.mReqSEQ;
+        mReqACK  = kept.mReqACK;
+        mRespSEQ = kept.mRespSEQ;
+        mRespACK = kept.mRespACK;
+    }
+};
+
 class PCapDumper {
-private:
-    static bool lookupIPv4(const char * host, struct in_addr & addr) {
-        struct in_addr ret;
-        if (inet_pton(AF_INET, host, &ret) == 1) {
-            memcpy(&addr, &ret, sizeof(struct in_addr));
-            return true;
+public:
+    enum FORMAT {
+        fmtPcap,    // classic pcap with microseconds
+        fmtPcapNG   // pcapng with nanoseconds and flow comments
+    };
+
+    /*
+     * Limits of output file, 0 - no limit. When next message would exceed
+     * one of them, output goes on in next file like tcpdump -C/-G does:
+     * "out.pcap", "out1.pcap", "out2.pcap"... Connections and their TCP
+     * numbers are kept by dumper, so they continue in next file. Span is
+     * time between first packet of file and packet of message.
+     */
+    struct Rotation {
+        uint64_t mMaxBytes;
+        uint64_t mMaxPackets;
+        int64_t mMaxSpan;       // nanoseconds
+
+        Rotation()
+            : mMaxBytes(0)
+            , mMaxPackets(0)
+            , mMaxSpan(0)
+        {}
+        bool enabled() const {
+            return mMaxBytes != 0 || mMaxPackets != 0 || mMaxSpan != 0;
         }
-        struct addrinfo hints, *p = NULL;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET; // use AF_INET6 to force IPv6
-        hints.ai_socktype = SOCK_STREAM;
-        int rv = getaddrinfo(host, NULL, &hints, &p);
-        if (rv != 0) {
-            //WARN("getaddrinfo: %s", gai_strerror(rv));
-            return false;
+    };
+
+    // output file per key of connection
+    enum SPLIT {
+        splitNone,
+        splitHost,          // by server address
+        splitConnection     // by addresses and ports
+    };
+
+    PCapDumper()
+        : mSkipped(0)
+        , mTCPCtx(nullptr)
+    { }
+    // bufferSize - size of output buffer, preallocate - bytes to reserve
+    // on disk for output file (0 - don't reserve)
+    PCapDumper(const std::string & path, FORMAT format = fmtPcap,
+               size_t bufferSize = 8 << 20, uint64_t preallocate = 0)
+        : mPath(path)
+        , mFormat(format)
+        , mBufferSize(bufferSize)
+        , mPreallocate(preallocate)
+        , mPackets(0)
+        , mBytesDone(0)
+        , mFiles(0)
+        , mSplit(splitNone)
+        , mMaxOpen(0)
+        , mSplitBufferSize(64 << 10)
+        , mOpen(0)
+        , mZstdLevel(0)
+        , mZstdWorkers(0)
+        , mSkipped(0)
+        , mTCPCtx(nullptr)
+        , mSum(sumFunc(csumAuto))
+    {
+        openFile(path);
+    }
+    ~PCapDumper() {
+        close();
+    }
+
+    bool isOK() const {
+        return mFile && mFile->isOpen() && mFile->errorString().empty() && mError.empty();
+    }
+
+    std::string errorString() const {
+        if (!mError.empty() || !mFile)
+            return mError;
+        return mFile->errorString();
+    }
+
+    FORMAT format() const {
+        return mFormat;
+    }
+
+    // files are rotated at limits, they should be set before first packet
+    void setRotation(const Rotation & rotation) {
+        mRotation = rotation;
+    }
+    /*
+     * Packets go to file per key of their connection instead of output
+     * file, e.g. "out.pcap" -> "out.10.0.0.1.pcap" or
+     * "out.10.0.0.1.443-10.0.0.2.51234.pcap"; it must be set before first
+     * packet and output file is removed. Not more than maxOpen of files
+     * are open, least recently used one is closed to open next and then
+     * reopened for appending. bufferSize - output buffer of each file.
+     */
+    void setSplit(SPLIT split, size_t maxOpen = 256, size_t bufferSize = 64 << 10) {
+        mSplit = split;
+        mMaxOpen = (maxOpen < 1 ? 1 : maxOpen);
+        mSplitBufferSize = bufferSize;
+        if (mSplit != splitNone && mFile) {
+            mFile->close();
+            ::remove(mFilePath.c_str());
+            mFiles = 0;
         }
-        memcpy(&addr, p->ai_addr, sizeof(struct in_addr));
-        freeaddrinfo(p);
-        return true;
     }
 
-    static bool lookupIPv6(const char * host, struct in6_addr & addr) {
-        struct in6_addr ret;
-        if (inet_pton(AF_INET6, host, &ret) == 1) {
-            memcpy(&addr, &ret, sizeof(struct in6_addr));
+    SPLIT split() const {
+        return mSplit;
+    }
+
+    /*
+     * gzip - complete files are compressed to <file>.gz by background
+     * thread; zstd - packets are compressed to <file>.zst as they are
+     * written by `workers` threads (split outputs use caller's thread
+     * only). It must be set before first packet.
+     */
+    bool setCompression(FileFinisher::COMPRESSION compression, int level = 6,
+                        unsigned workers = 0) {
+        if (!FileFinisher::isSupported(compression))
+            return false;
+        if (compression != FileFinisher::cmpZstd) {
+            mFinisher.setCompression(compression, level);
             return true;
         }
-        struct addrinfo hints, *p = NULL;
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET6; // use AF_INET6 to force IPv6
-        hints.ai_socktype = SOCK_STREAM;
-        int rv = getaddrinfo(host, NULL, &hints, &p);
-        if (rv != 0) {
-            //WARN("getaddrinfo: %s", gai_strerror(rv));
-            return false;
+        mZstdLevel = level;
+        mZstdWorkers = workers;
+        if (mFile && mFile->isOpen() && BufferedFile::isStdout(mFilePath)) {
+            // header is still in buffer, so it's compressed too
+            if (!mFile->setZstd(level, workers))
+                mError = mFile->errorString();
+        } else if (mFile && mFile->isOpen()) {
+            // output file is created again with suffix
+            mFile->close();
+            ::remove(mFilePath.c_str());
+            --mFiles;
+            openFile(mPath);
         }
-        memcpy(&addr, p->ai_addr, sizeof(struct in6_addr));
-        freeaddrinfo(p);
-        return true;
+        return mError.empty();
     }
 
-public:
-    PCapDumper() : mHandle(nullptr), mDumper(nullptr) { }
-    PCapDumper(const std::string & path) {
-        mHandle = pcap_open_dead(DLT_RAW, 1 << 16);
-        mDumper = pcap_dump_open(mHandle, path.c_str());
+    // write buffered packets of open files, so their readers get them
+    bool flush() {
+        if (mSplit != splitNone) {
+            for (size_t i = 0; i < mOutputs.size(); ++i) {
+                if (mOutputs[i].mFile && !mOutputs[i].mFile->sync() && mError.empty())
+                    mError = mOutputs[i].mFile->errorString();
+            }
+        } else if (mFile && !mFile->sync()) {
+            mError = mFile->errorString();
+        }
+        return mError.empty();
     }
-    ~PCapDumper() {
-        if (mDumper != nullptr) {
-            pcap_dump_close(mDumper);
-            mDumper = nullptr;
+
+    // flush buffered packets and close file, rotated ones are waited for
+    bool close() {
+        if (!mFile)
+            return mError.empty();
+        bool ok = true;
+        if (mSplit == splitNone) {
+            std::string path = mFilePath;
+            finishFile();
+            ok = mFinisher.finish(std::move(mFile), path);
+        } else {
+            closeSplit();
+            mFile.reset();
         }
-        if (mHandle != nullptr) {
-            pcap_close(mHandle);
-            mHandle = nullptr;
+        ok = mFinisher.wait() && ok;
+        if (!ok && mError.empty())
+            mError = mFinisher.errorString();
+        return mError.empty();
+    }
+
+    // of all files
+    uint64_t bytesWritten() const {
+        uint64_t bytes = mBytesDone;
+        if (mSplit != splitNone) {
+            for (size_t i = 0; i < mOutputs.size(); ++i) {
+                bytes += (mOutputs[i].mFile ? mOutputs[i].mFile->bytesWritten() : 0);
+            }
+        } else if (mFile) {
+            bytes += mFile->bytesWritten();
         }
+        return bytes;
+    }
+    uint64_t packets() const {
+        return mPackets;
     }
 
-    bool isOK() const {
-        return mHandle != nullptr && mDumper != nullptr;
+    // message isn't written as its connection has no addresses, e.g.
+    // host isn't resolved or server and client are of different families
+    void skip() {
+        ++mSkipped;
+    }
+    uint64_t skipped() const {
+        return mSkipped;
+    }
+    // files opened so far
+    unsigned files() const {
+        return mFiles;
     }
 
-    std::string errorString() const {
-        if (mHandle == nullptr)
-            return std::string("pcap_open_dead() failed.");
-        return std::string(pcap_geterr(mHandle));
+    // resolution of host names given to setAddrs()
+    AddressResolver & resolver() {
+        return mResolver;
+    }
+
+    // how checksums are computed, false if CPU doesn't support impl
+    bool setChecksum(CHECKSUM impl) {
+        mSum = sumFunc(impl);
+        return (mSum != nullptr || impl == csumNone);
+    }
+
+    // connections are dropped after their last retained event was written
+    void setEviction(bool on) {
+        mConns.setEviction(on);
+    }
+
+    // binary key of connection, hosts are address literals or names
+    bool connKey(const char * srv, size_t srvLen, u_int16_t srvPort,
+                 const char * cli, size_t cliLen, u_int16_t cliPort, ConnKey & key) {
+        const HostAddress & addrSrv = mResolver.resolve(srv, srvLen);
+        const HostAddress & addrCli = mResolver.resolve(cli, cliLen);
+        key = ConnKey();
+        if (addrSrv.mHasIPv4 && addrCli.mHasIPv4) {
+            key.mFamily = AF_INET;
+            memcpy(key.mSrv, &addrSrv.mIPv4, sizeof(in_addr));
+            memcpy(key.mCli, &addrCli.mIPv4, sizeof(in_addr));
+        } else if (addrSrv.mHasIPv6 && addrCli.mHasIPv6) {
+            key.mFamily = AF_INET6;
+            memcpy(key.mSrv, &addrSrv.mIPv6, sizeof(in6_addr));
+            memcpy(key.mCli, &addrCli.mIPv6, sizeof(in6_addr));
+        } else {
+            return false;
+        }
+        key.mPortSrv = srvPort;
+        key.mPortCli = cliPort;
+        return true;
+    }
+
+    // select connection for next messages
+    void setConnection(const ConnKey & key) {
+        mTCPCtx = mConns.get(key);
+        if (!mTCPCtx->mReady) {
+            makeHeader(mTCPCtx->mToSrv, key.mFamily, key.mCli, key.mSrv, key.mPortCli, key.mPortSrv);
+            makeHeader(mTCPCtx->mToCli, key.mFamily, key.mSrv, key.mCli, key.mPortSrv, key.mPortCli);
+            mTCPCtx->mReady = true;
+        }
+        if (mSplit != splitNone && mTCPCtx->mOutput == 0) {
+            mTCPCtx->mOutput = outputOf(key) + 1;
+        }
     }
 
-    //
+    // select connection, hosts are address literals or names
     bool setAddrs(const std::string & srv, const std::string & srvPort,
                   const std::string & cli, const std::string & cliPort) {
-        mUseIPv4 = false;
-        mUseIPv6 = false;
-        mUseIPv4 = lookupIPv4(srv.c_str(), mIPv4Srv);
-        if (mUseIPv4)
-            mUseIPv4 = lookupIPv4(cli.c_str(), mIPv4Cli);
-        if (!mUseIPv4) {
-            mUseIPv6 = lookupIPv6(srv.c_str(), mIPv6Srv);
-            if (mUseIPv6)
-                mUseIPv6 = lookupIPv6(cli.c_str(), mIPv6Cli);
-        }
-
-        if (!mUseIPv4 && !mUseIPv6)
+        ConnKey key;
+        if (!connKey(srv.data(), srv.size(), (u_int16_t) atol(srvPort.c_str()),
+                     cli.data(), cli.size(), (u_int16_t) atol(cliPort.c_str()), key))
             return false;
-
-        mPortSrv = atol(srvPort.c_str());
-        mPortCli = atol(cliPort.c_str());
-
-        std::string k(srv + ":" + srvPort + ":" + cli + ":" + cliPort);
-        mTCPCtx = mTCPseqs[k];
-        if (mTCPCtx.get() == nullptr) {
-            mTCPCtx = std::shared_ptr<TCPContext>(new TCPContext);
-            mTCPCtx->mReqSEQ = 0;
-            mTCPCtx->mReqACK = 0;
-            mTCPCtx->mRespSEQ = 0;
-            mTCPCtx->mRespACK = 0;
-            mTCPseqs[k] = mTCPCtx;
-        }
-#if (0)
-        std::cerr << "DBG: " << k
-                  << " " << mTCPCtx->mReqACK
-                  << " " << mTCPCtx->mReqSEQ
-                  << " " << mTCPCtx->mRespACK
-                  << " " << mTCPCtx->mRespSEQ
-                  << "\n";
-#endif
+        setConnection(key);
         return true;
     }
 
-    void dump(const u_char* data, size_t len, const struct timeval & ts, bool request) {
-        const size_t MAX_MTU = (0xFFFF - 40);
-        u_char buffer[MAX_MTU + 40];
-        size_t total = 0, maxData = len;
-        hdrIPv4 *pip4  = (hdrIPv4*) (buffer);
-        hdrTCP  *ptcp  = (hdrTCP*)  (buffer + sizeof(hdrIPv4));
-        u_char  *pdata = (buffer + sizeof(hdrIPv4) + sizeof(hdrTCP));
-        u_int32_t fragments;
-        size_t dataLen;
-        struct pcap_pkthdr pcap_hdr;
+    // connection has event which will be written later
+    void retain(const ConnKey & key) {
+        mConns.retain(key);
+        mTCPCtx = nullptr;
+    }
+    void release(const ConnKey & key) {
+        mConns.release(key);
+    }
+
+    const ConnTable<TCPContext> & connections() const {
+        return mConns;
+    }
+
+    /*
+     * Writing of HTTP message is split in two steps, so packets of many
+     * messages could be built in parallel:
+     *  - message() takes addresses and TCP numbers for message of len bytes
+     *    from current connection and moves them forward, it must be called
+     *    in order of messages;
+     *  - build() makes packets of message and appends them to batch, it
+     *    doesn't touch dumper's state.
+     * Batches are written by write() in order of their messages.
+     *
+     * Message data is given as list of slices, e.g. HTTP start line,
+     * headers and body laying in parsed input. Batch refers to them, so
+     * they must live until batch is written.
+     */
+
+    struct Message {
+        PacketHeader mToSrv;
+        PacketHeader mToCli;
+        u_int32_t mSEQ;
+        size_t mLength;
+        int64_t mTs;           // nanoseconds since epoch
+        u_int32_t mOutput;     // split output + 1, 0 - output file
+        bool mRequest;
+        FORMAT mFormat;
+        SumFunc mSum;          // nullptr - no checksums
+        std::string mComment;     // comment of pcapng packets of data
+        std::string mAckComment;  // and of ACKs going back
+    };
 
-        // load ACK and SEQ values
-        u_int32_t SEQ, ACK;
+    // records of packets as own bytes of headers and slices of message data
+    struct PacketBatch {
+        // message starts at slice mSlice and has mPackets records
+        struct Mark {
+            size_t mSlice;
+            int64_t mTs;
+            u_int32_t mPackets;
+            u_int32_t mOutput;
+        };
+        std::vector<u_char> mBytes;
+        std::vector<Slice> mSlices;  // mData is nullptr for next mLength bytes of mBytes
+        std::vector<Mark> mMarks;
+
+        void clear() {
+            mBytes.clear();
+            mSlices.clear();
+            mMarks.clear();
+        }
+        void addMessage(int64_t ts, u_int32_t output) {
+            Mark mark = { mSlices.size(), ts, 0, output };
+            mMarks.push_back(mark);
+        }
+        // append zeroed bytes, returns their offset in mBytes; slices of
+        // different messages aren't joined
+        size_t addBytes(size_t len) {
+            size_t pos = mBytes.size();
+            mBytes.resize(pos + len, 0);
+            if (!mSlices.empty() && mSlices.back().mData == nullptr &&
+                (mMarks.empty() || mMarks.back().mSlice < mSlices.size())) {
+                mSlices.back().mLength += len;
+            } else {
+                Slice own = { nullptr, len };
+                mSlices.push_back(own);
+            }
+            return pos;
+        }
+        void addBytes(const void * data, size_t len) {
+            memcpy(&mBytes[addBytes(len)], data, len);
+        }
+        void addSlice(const void * data, size_t len) {
+            Slice slice = { data, len };
+            mSlices.push_back(slice);
+        }
+    };
+
+    // ts - nanoseconds since epoch, flowId - written to pcapng comments
+    Message message(size_t len, int64_t ts, bool request,
+                    const std::string & flowId = std::string()) {
+        Message msg;
+        msg.mToSrv   = mTCPCtx->mToSrv;
+        msg.mToCli   = mTCPCtx->mToCli;
+        msg.mLength  = len;
+        msg.mTs      = ts;
+        msg.mOutput  = mTCPCtx->mOutput;
+        msg.mRequest = request;
+        msg.mFormat  = mFormat;
+        msg.mSum     = mSum;
+        if (mFormat == fmtPcapNG) {
+            // "flow=<id> request", ACKs of it are "flow=<id> request ack"
+            msg.mComment = (flowId.empty() ? std::string() : "flow=" + flowId + " ") +
+                           (request ? "request" : "response");
+            msg.mAckComment = msg.mComment + " ack";
+        }
+
+        // load SEQ value and store SEQ and ACK for using in next flows
+        u_int32_t & SEQ = (request ? mTCPCtx->mReqSEQ : mTCPCtx->mRespSEQ);
+        msg.mSEQ = SEQ;
+        SEQ = (u_int32_t) ((SEQ + len) % 0xffffffff);
         if (request) {
-            SEQ = mTCPCtx->mReqSEQ;
-            ACK = mTCPCtx->mRespACK;
+            mTCPCtx->mRespACK = SEQ;
         } else {
-            SEQ = mTCPCtx->mRespSEQ;
-            ACK = mTCPCtx->mReqACK;
+            mTCPCtx->mReqACK  = SEQ;
         }
+        return msg;
+    }
 
+    static void build(const Message & msg, const Slice * pieces, size_t count, PacketBatch & batch) {
+        // data goes in direction of message, ACKs come back
+        const PacketHeader & hdrData = (msg.mRequest ? msg.mToSrv : msg.mToCli);
+        const PacketHeader & hdrAck  = (msg.mRequest ? msg.mToCli : msg.mToSrv);
+        // whole packet of either family fits into 0xFFFF bytes and snaplen
+        const size_t MAX_MTU = 0xFFFF - hdrData.mIPSize - sizeof(hdrTCP);
+        size_t total = 0, maxData = msg.mLength, len;
+        size_t piece = 0, pieceOffset = 0;
+        u_int32_t SEQ = msg.mSEQ, ACK;
+
+        batch.addMessage(msg.mTs, msg.mOutput);
         bool fragmented;
         do {
             fragmented = (maxData - total > MAX_MTU);
             len = (fragmented ? MAX_MTU : (maxData - total));
 
-            memset((void*)pip4, 0, sizeof(hdrIPv4));
-            memset((void*)ptcp, 0, sizeof(hdrTCP));
-            memcpy(pdata, data+total, len);
-            fragments = total + len;
-            dataLen = len;
-
-            pip4->iph_ver = 4;
-            pip4->iph_ihl = 5;
-            pip4->iph_protocol = 6;
-            pip4->iph_tos = 48;
-            pip4->iph_ttl = 45;
-            ptcp->tcph_offset = 5;
+            // payload refers to pieces, its sum is taken on the way
+            size_t hdrLen = hdrData.mIPSize + sizeof(hdrTCP);
+            size_t pos = beginRecord(batch, msg, msg.mComment, hdrLen, hdrLen + len);
+            uint64_t sum = 0;
+            for (size_t done = 0; done < len && piece < count; ) {
+                const u_char * p = (const u_char *) pieces[piece].mData + pieceOffset;
+                size_t n = std::min(len - done, pieces[piece].mLength - pieceOffset);
+                batch.addSlice(p, n);
+                if (msg.mSum) {
+                    uint64_t s = msg.mSum(p, n);
+                    sum += ((done & 1) ? oddSum(s) : s);
+                }
+                done += n;
+                pieceOffset += n;
+                if (pieceOffset == pieces[piece].mLength) {
+                    ++piece;
+                    pieceOffset = 0;
+                }
+            }
+            endRecord(batch, msg, msg.mComment, hdrLen + len);
 
-            if (request) {
-                pip4->iph_sourceip  = mIPv4Cli.s_addr;
-                pip4->iph_destip    = mIPv4Srv.s_addr;
-                ptcp->tcph_srcport  = htons(mPortCli);
-                ptcp->tcph_destport = htons(mPortSrv);
-            } else {
-                pip4->iph_sourceip  = mIPv4Srv.s_addr;
-                pip4->iph_destip    = mIPv4Cli.s_addr;
-                ptcp->tcph_srcport  = htons(mPortSrv);
-                ptcp->tcph_destport = htons(mPortCli);
+            u_char * packet = &batch.mBytes[pos];
+            memcpy(packet, hdrData.mData, hdrLen);
+            hdrTCP * ptcp = (hdrTCP*) (packet + hdrData.mIPSize);
+            ptcp->tcph_win    = htons((u_int16_t) (len + sizeof(hdrTCP)));
+            ptcp->tcph_seqnum = htonl(SEQ);
+            setLength(packet, hdrData.mIPSize, hdrLen + len);
+            if (msg.mSum) {
+                setChecksums(packet, hdrData, hdrLen + len, sum);
             }
+            total += len;
 
-            len += sizeof(hdrTCP);
-            ptcp->tcph_win      = htons(len);
-            ptcp->tcph_chksum   = 0;
-            ptcp->tcph_ack      = 0;
-            len += sizeof(hdrIPv4);
-            pip4->iph_len       = htons(len);
-            pip4->iph_chksum    = 0;
-            ptcp->tcph_seqnum   = htonl(SEQ);
-            ptcp->tcph_acknum   = 0;
-            pip4->iph_flags     = 0;
-
-            // TODO: calculate checksums before send
-
-            pcap_hdr.caplen = len;
-            pcap_hdr.len    = len;
-            pcap_hdr.ts     = ts;
-            pcap_dump((u_char*)mDumper, &pcap_hdr, buffer);
-            total = fragments;
-
-            SEQ = (SEQ + dataLen) % 0xffffffff;
+            SEQ = (SEQ + len) % 0xffffffff;
             ACK = SEQ;
 
             // write TCP ACK from reciever
-
-            std::swap(pip4->iph_sourceip, pip4->iph_destip);
-            std::swap(ptcp->tcph_srcport, ptcp->tcph_destport);
+            hdrLen = hdrAck.mIPSize + sizeof(hdrTCP);
+            pos = beginRecord(batch, msg, msg.mAckComment, hdrLen, hdrLen);
+            endRecord(batch, msg, msg.mAckComment, hdrLen);
+            packet = &batch.mBytes[pos];
+            memcpy(packet, hdrAck.mData, hdrLen);
+            ptcp = (hdrTCP*) (packet + hdrAck.mIPSize);
             ptcp->tcph_win    = htons(1024);
-            ptcp->tcph_chksum = 0;
             ptcp->tcph_ack    = 1;
-            pip4->iph_len     = htons(40);
-            pip4->iph_chksum  = 0;
-            ptcp->tcph_seqnum = 0;
             ptcp->tcph_acknum = htonl(ACK);
-            pcap_hdr.caplen   = 40;
-            pcap_hdr.len      = 40;
-            pcap_hdr.ts       = ts;
-            // TODO: calculate checksums before send
-            pcap_dump((u_char*)mDumper, &pcap_hdr, buffer);
+            setLength(packet, hdrAck.mIPSize, hdrLen);
+            if (msg.mSum) {
+                setChecksums(packet, hdrAck, hdrLen, 0);
+            }
         } while (fragmented);
-        // store TCP ACK and SEQ values for using in next flows
-        if (request) {
-            mTCPCtx->mReqSEQ  = SEQ;
-            mTCPCtx->mRespACK = ACK;
-        } else {
-            mTCPCtx->mRespSEQ = SEQ;
-            mTCPCtx->mReqACK  = ACK;
+    } // build()
+
+    // write records of batch and data of slices they refer to, file is
+    // rotated between messages
+    void write(const PacketBatch & batch) {
+        mGather.resize(batch.mSlices.size());
+        const u_char * own = batch.mBytes.data();
+        for (size_t i = 0; i < batch.mSlices.size(); ++i) {
+            mGather[i] = batch.mSlices[i];
+            if (mGather[i].mData == nullptr) {
+                mGather[i].mData = own;
+                own += mGather[i].mLength;
+            }
+        }
+        if (!mRotation.enabled() && mSplit == splitNone) {
+            for (size_t m = 0; m < batch.mMarks.size(); ++m) {
+                count(mStats, batch.mMarks[m]);
+            }
+            mFile->appendv(mGather.data(), mGather.size());
+            return;
         }
+        for (size_t m = 0; m < batch.mMarks.size(); ++m) {
+            const PacketBatch::Mark & mark = batch.mMarks[m];
+            size_t end = (m + 1 < batch.mMarks.size() ? batch.mMarks[m + 1].mSlice : mGather.size());
+            if (mSplit != splitNone && mark.mOutput != 0) {
+                Output & out = mOutputs[mark.mOutput - 1];
+                count(out.mStats, mark);
+                if (useOutput(out))
+                    out.mFile->appendv(&mGather[mark.mSlice], end - mark.mSlice);
+                continue;
+            }
+            uint64_t len = 0;
+            for (size_t i = mark.mSlice; i < end; ++i) {
+                len += mGather[i].mLength;
+            }
+            if (mStats.mPackets != 0 && exceeds(mark, len))
+                rotate();
+            count(mStats, mark);
+            mFile->appendv(&mGather[mark.mSlice], end - mark.mSlice);
+        }
+    }
+
+    // message of len bytes given by pieces
+    void dump(const Slice * pieces, size_t count, size_t len, int64_t ts, bool request,
+              const std::string & flowId = std::string()) {
+        mBatch.clear();
+        build(message(len, ts, request, flowId), pieces, count, mBatch);
+        write(mBatch);
+    }
+
+    void dump(const u_char* data, size_t len, int64_t ts, bool request,
+              const std::string & flowId = std::string()) {
+        Slice piece = { data, len };
+        dump(&piece, 1, len, ts, request, flowId);
     } // dump()
 
 private:
-    pcap_t * mHandle;
-    pcap_dumper_t * mDumper;
-    in_addr mIPv4Srv, mIPv4Cli;
-    in6_addr mIPv6Srv, mIPv6Cli;
-    bool mUseIPv4, mUseIPv6;
-    u_int16_t mPortSrv;
-    u_int16_t mPortCli;
-    struct TCPContext {
-        u_int32_t mReqSEQ;
-        u_int32_t mReqACK;
-        u_int32_t mRespSEQ;
-        u_int32_t mRespACK;
+    // packets of file and their time range
+    struct FileStats {
+        uint64_t mPackets;
+        int64_t mFirstTs, mLastTs;
+        FileStats()
+            : mPackets(0)
+            , mFirstTs(0)
+            , mLastTs(0)
+        {}
     };
-    typedef std::shared_ptr<TCPContext> PTCPContext;
-    std::map<std::string, PTCPContext> mTCPseqs;
-    PTCPContext mTCPCtx;
+
+    // file of split output, mFile is null while it's closed
+    struct Output {
+        std::string mPath;
+        std::unique_ptr<BufferedFile> mFile;
+        bool mCreated;                         // header is written
+        bool mDone;                            // finished by closeSplit()
+        FileStats mStats;
+        std::list<u_int32_t>::iterator mLru;   // valid while file is open
+        Output() : mCreated(false), mDone(false)
+        {}
+    };
+
+    // create file and write its header
+    void openFile(const std::string & path) {
+        mFile.reset(new BufferedFile());
+        mFilePath = compressedPath(path);
+        mStats = FileStats();
+        ++mFiles;
+        if (!mFile->open(mFilePath, mBufferSize, mPreallocate) ||
+            (mZstdLevel != 0 && !mFile->setZstd(mZstdLevel, mZstdWorkers))) {
+            mError = mFile->errorString();
+            return;
+        }
+        writeHeader(*mFile);
+    }
+
+    // file name of compressed output
+    std::string compressedPath(const std::string & path) const {
+        return (mZstdLevel != 0 && !BufferedFile::isStdout(path) ? path + ".zst" : path);
+    }
+
+    // pcap file header or pcapng section header
+    void writeHeader(BufferedFile & file) {
+        if (mFormat == fmtPcapNG) {
+            writeSectionHeader(file);
+        } else {
+            hdrPcapFile hdr;
+            hdr.magic_number  = 0xa1b2c3d4;
+            hdr.version_major = 2;
+            hdr.version_minor = 4;
+            hdr.thiszone      = 0;
+            hdr.sigfigs       = 0;
+            hdr.snaplen       = 1 << 16;
+            hdr.network       = LINKTYPE_RAW;
+            file.append(&hdr, sizeof(hdr));
+        }
+    }
+
+    // trailer of current file, it's closed by caller or finisher
+    void finishFile() {
+        if (mFile->isOpen() && mFormat == fmtPcapNG)
+            writeStatistics(*mFile, mStats);
+        mBytesDone += mFile->bytesWritten();
+    }
+
+    // next file, current one is finished on background
+    void rotate() {
+        std::string path = mFilePath;
+        finishFile();
+        mFinisher.add(std::move(mFile), path);
+        openFile(rotatedPath(mPath, mFiles));
+    }
+
+    // "out.pcap" -> "out<n>.pcap"
+    static std::string rotatedPath(const std::string & path, unsigned n) {
+        char num[16];
+        snprintf(num, sizeof(num), "%u", n);
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return path + num;
+        return path.substr(0, dot) + num + path.substr(dot);
+    }
+
+    // message would exceed limit of current file
+    bool exceeds(const PacketBatch::Mark & mark, uint64_t len) const {
+        return (mRotation.mMaxBytes != 0 && mFile->bytesWritten() + len > mRotation.mMaxBytes) ||
+               (mRotation.mMaxPackets != 0 && mStats.mPackets + mark.mPackets > mRotation.mMaxPackets) ||
+               (mRotation.mMaxSpan != 0 && mark.mTs - mStats.mFirstTs >= mRotation.mMaxSpan);
+    }
+
+    // statistics of written message
+    void count(FileStats & stats, const PacketBatch::Mark & mark) {
+        if (stats.mPackets == 0 || mark.mTs < stats.mFirstTs) stats.mFirstTs = mark.mTs;
+        if (stats.mPackets == 0 || mark.mTs > stats.mLastTs) stats.mLastTs = mark.mTs;
+        mPackets += mark.mPackets;
+        stats.mPackets += mark.mPackets;
+    }
+
+    // index of split output of connection, it's created on first use
+    u_int32_t outputOf(const ConnKey & key) {
+        std::string name = addrName(key.mFamily, key.mSrv);
+        if (mSplit == splitConnection) {
+            char ports[32];
+            snprintf(ports, sizeof(ports), ".%u-", (unsigned) key.mPortSrv);
+            name += ports + addrName(key.mFamily, key.mCli);
+            snprintf(ports, sizeof(ports), ".%u", (unsigned) key.mPortCli);
+            name += ports;
+        }
+        std::unordered_map<std::string, u_int32_t>::const_iterator it = mOutputIds.find(name);
+        if (it != mOutputIds.end())
+            return it->second;
+        u_int32_t id = (u_int32_t) mOutputs.size();
+        mOutputs.push_back(Output());
+        mOutputs.back().mPath = compressedPath(splitPath(mPath, name));
+        mOutputIds[name] = id;
+        ++mFiles;
+        return id;
+    }
+
+    // address with ':' of IPv6 replaced as it's not allowed in some file systems
+    static std::string addrName(int family, const u_int8_t * addr) {
+        char buf[INET6_ADDRSTRLEN];
+        if (inet_ntop(family, addr, buf, sizeof(buf)) == nullptr)
+            return "unknown";
+        std::string name = buf;
+        std::replace(name.begin(), name.end(), ':', '_');
+        return name;
+    }
+
+    // "out.pcap" -> "out.<name>.pcap"
+    static std::string splitPath(const std::string & path, const std::string & name) {
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return path + "." + name;
+        return path.substr(0, dot) + "." + name + path.substr(dot);
+    }
+
+    // open file of output, least recently used one is closed if there
+    // are too many of them; false if file can't be written
+    bool useOutput(Output & out) {
+        if (out.mFile) {
+            if (out.mLru != mLru.begin())
+                mLru.splice(mLru.begin(), mLru, out.mLru);
+            return true;
+        }
+        if (!mError.empty())
+            return false;
+        if (mOpen >= mMaxOpen) {
+            Output & old = mOutputs[mLru.back()];
+            mLru.pop_back();
+            --mOpen;
+            if ((!old.mFile->close() || !old.mFile->errorString().empty()) && mError.empty())
+                mError = old.mFile->errorString();
+            mBytesDone += old.mFile->bytesWritten();
+            old.mFile.reset();
+        }
+        out.mFile.reset(new BufferedFile());
+        // each reopening of zstd file adds frame to it
+        if (!out.mFile->open(out.mPath, mSplitBufferSize, 0, out.mCreated) ||
+            (mZstdLevel != 0 && !out.mFile->setZstd(mZstdLevel))) {
+            mError = out.mFile->errorString();
+            out.mFile.reset();
+            return false;
+        }
+        if (!out.mCreated) {
+            writeHeader(*out.mFile);
+            out.mCreated = true;
+        }
+        mLru.push_front((u_int32_t) (&out - &mOutputs[0]));
+        out.mLru = mLru.begin();
+        ++mOpen;
+        return true;
+    }
+
+    // each output is finished on caller's thread: open ones first, then
+    // closed ones are reopened one by one, so all of them are finished
+    // alike and not more than mMaxOpen files are ever open
+    void closeSplit() {
+        while (!mLru.empty()) {
+            finishOutput(mOutputs[mLru.front()]);
+        }
+        for (size_t i = 0; i < mOutputs.size(); ++i) {
+            Output & out = mOutputs[i];
+            if (out.mCreated && !out.mDone && useOutput(out))
+                finishOutput(out);
+        }
+    }
+
+    // statistics of open output are written, it's closed and compressed
+    void finishOutput(Output & out) {
+        if (mFormat == fmtPcapNG)
+            writeStatistics(*out.mFile, out.mStats);
+        mLru.erase(out.mLru);
+        --mOpen;
+        mBytesDone += out.mFile->bytesWritten();
+        out.mDone = true;
+        if (!mFinisher.finish(std::move(out.mFile), out.mPath) && mError.empty())
+            mError = mFinisher.errorString();
+    }
+
+    // IP and TCP headers of packets from src to dst, addresses are of family
+    static void makeHeader(PacketHeader & hdr, int family, const u_int8_t * src,
+                           const u_int8_t * dst, u_int16_t srcPort, u_int16_t dstPort) {
+        memset(&hdr, 0, sizeof(hdr));
+        if (family == AF_INET6) {
+            hdrIPv6 * pip6 = (hdrIPv6*) hdr.mData;
+            pip6->ip6_flow = htonl((6u << 28) | (48u << 20));
+            pip6->ip6_nxt  = 6;
+            pip6->ip6_hlim = 45;
+            memcpy(pip6->ip6_src, src, 16);
+            memcpy(pip6->ip6_dst, dst, 16);
+            hdr.mIPSize = sizeof(hdrIPv6);
+        } else {
+            hdrIPv4 * pip4 = (hdrIPv4*) hdr.mData;
+            pip4->iph_ver = 4;
+            pip4->iph_ihl = 5;
+            pip4->iph_protocol = 6;
+            pip4->iph_tos = 48;
+            pip4->iph_ttl = 45;
+            memcpy(&pip4->iph_sourceip, src, 4);
+            memcpy(&pip4->iph_destip, dst, 4);
+            hdr.mIPSize = sizeof(hdrIPv4);
+        }
+        hdrTCP * ptcp = (hdrTCP*) (hdr.mData + hdr.mIPSize);
+        ptcp->tcph_offset   = 5;
+        ptcp->tcph_srcport  = htons(srcPort);
+        ptcp->tcph_destport = htons(dstPort);
+        size_t addrLen = (family == AF_INET6 ? 16 : 4);
+        hdr.mPseudoSum = (u_int16_t) ~checksum(sumWords(src, addrLen) +
+                                               sumWords(dst, addrLen) + htons(6));
+    }
+
+    // IPv4 header and TCP checksums of packet, payloadSum - partial sum of TCP data
+    static void setChecksums(u_char * packet, const PacketHeader & hdr, size_t len,
+                             uint64_t payloadSum) {
+        hdrTCP * ptcp = (hdrTCP*) (packet + hdr.mIPSize);
+        uint64_t sum = payloadSum + hdr.mPseudoSum + htons((u_int16_t) (len - hdr.mIPSize)) +
+                       sumWords(ptcp, sizeof(hdrTCP));
+        ptcp->tcph_chksum = checksum(sum);
+        if (hdr.mIPSize == sizeof(hdrIPv4)) {
+            hdrIPv4 * pip4 = (hdrIPv4*) packet;
+            pip4->iph_chksum = checksum(sumWords(pip4, sizeof(hdrIPv4)));
+        }
+    }
+
+    // set length field of IP header to size of whole packet
+    static void setLength(u_char * packet, size_t ipSize, size_t len) {
+        if (ipSize == sizeof(hdrIPv6)) {
+            ((hdrIPv6*) packet)->ip6_plen = htons((u_int16_t) (len - sizeof(hdrIPv6)));
+        } else {
+            ((hdrIPv4*) packet)->iph_len = htons((u_int16_t) len);
+        }
+    }
+
+    // append header of record of packet of len bytes in file format of
+    // message and hdrLen bytes for IP and TCP headers, returns their offset
+    static size_t beginRecord(PacketBatch & batch, const Message & msg, const std::string & comment,
+                              size_t hdrLen, size_t len) {
+        ++batch.mMarks.back().mPackets;
+        if (msg.mFormat == fmtPcap) {
+            hdrPcapRecord hdr;
+            hdr.ts_sec   = (u_int32_t) (msg.mTs / 1000000000);
+            hdr.ts_usec  = (u_int32_t) (msg.mTs % 1000000000 / 1000);
+            hdr.incl_len = (u_int32_t) len;
+            hdr.orig_len = (u_int32_t) len;
+            batch.addBytes(&hdr, sizeof(hdr));
+        } else {
+            // Enhanced Packet Block
+            hdrPcapngEPB hdr;
+            hdr.block_type         = PCAPNG_EPB;
+            hdr.block_total_length = epbLength(comment, len);
+            hdr.interface_id       = 0;
+            hdr.ts_high            = (u_int32_t) ((uint64_t) msg.mTs >> 32);
+            hdr.ts_low             = (u_int32_t) ((uint64_t) msg.mTs);
+            hdr.captured_len       = (u_int32_t) len;
+            hdr.original_len       = (u_int32_t) len;
+            batch.addBytes(&hdr, sizeof(hdr));
+        }
+        return batch.addBytes(hdrLen);
+    }
+
+    // padding and options of pcapng block of packet of len bytes
+    static void endRecord(PacketBatch & batch, const Message & msg, const std::string & comment,
+                          size_t len) {
+        if (msg.mFormat == fmtPcap)
+            return;
+        size_t pos = batch.addBytes(pad4(len) - len + sizeof(hdrPcapngOption) * 2 +
+                                    pad4(comment.size()) + 4);
+        u_char * p = &batch.mBytes[pos] + (pad4(len) - len);
+        p = putOption(p, PCAPNG_OPT_COMMENT, comment.data(), comment.size());
+        p = putOption(p, PCAPNG_OPT_END, nullptr, 0);
+        u_int32_t total = epbLength(comment, len);
+        memcpy(p, &total, 4);
+    }
+
+    static u_int32_t epbLength(const std::string & comment, size_t len) {
+        return (u_int32_t) (sizeof(hdrPcapngEPB) + pad4(len) + sizeof(hdrPcapngOption) * 2 +
+                            pad4(comment.size()) + 4);
+    }
+
+    static size_t pad4(size_t len) {
+        return (len + 3) & ~(size_t) 3;
+    }
+
+    // option padded to 32 bits, memory after data is expected to be zeroed
+    static u_char * putOption(u_char * p, u_int16_t code, const void * data, size_t len) {
+        hdrPcapngOption opt;
+        opt.code = code;
+        opt.length = (u_int16_t) len;
+        memcpy(p, &opt, sizeof(opt));
+        p += sizeof(opt);
+        if (len) memcpy(p, data, len);
+        return p + pad4(len);
+    }
+
+    // write block with options given as (code, data, length) list
+    struct Option {
+        u_int16_t mCode;
+        const void * mData;
+        size_t mLength;
+    };
+    void writeBlock(BufferedFile & file, u_int32_t type, const void * body, size_t bodyLen,
+                    const Option * options, size_t count) {
+        size_t total = sizeof(hdrPcapngBlock) + bodyLen + sizeof(hdrPcapngOption) + 4;
+        for (size_t i = 0; i < count; ++i) {
+            total += sizeof(hdrPcapngOption) + pad4(options[i].mLength);
+        }
+        std::vector<u_char> block(total, 0);
+        hdrPcapngBlock hdr;
+        hdr.block_type = type;
+        hdr.block_total_length = (u_int32_t) total;
+        u_char * p = &block[0];
+        memcpy(p, &hdr, sizeof(hdr));
+        p += sizeof(hdr);
+        memcpy(p, body, bodyLen);
+        p += bodyLen;
+        for (size_t i = 0; i < count; ++i) {
+            p = putOption(p, options[i].mCode, options[i].mData, options[i].mLength);
+        }
+        p = putOption(p, PCAPNG_OPT_END, nullptr, 0);
+        memcpy(p, &hdr.block_total_length, 4);
+        file.append(block.data(), block.size());
+    }
+
+    // Section Header and Interface Description blocks
+    void writeSectionHeader(BufferedFile & file) {
+        struct {
+            u_int32_t byte_order_magic;
+            u_int16_t major_version;
+            u_int16_t minor_version;
+            u_int32_t section_length[2];
+        } shb = { 0x1A2B3C4D, 1, 0, { 0xFFFFFFFF, 0xFFFFFFFF } };
+        const char userappl[] = "mitmproxy2pcap";
+        Option shbOptions[] = {
+            { PCAPNG_SHB_USERAPPL, userappl, sizeof(userappl) - 1 }
+        };
+        writeBlock(file, PCAPNG_SHB, &shb, sizeof(shb), shbOptions, 1);
+
+        struct {
+            u_int16_t linktype;
+            u_int16_t reserved;
+            u_int32_t snaplen;
+        } idb = { LINKTYPE_RAW, 0, 1 << 16 };
+        const u_int8_t tsresol = 9; // nanoseconds
+        Option idbOptions[] = {
+            { PCAPNG_IF_TSRESOL, &tsresol, 1 }
+        };
+        writeBlock(file, PCAPNG_IDB, &idb, sizeof(idb), idbOptions, 1);
+    }
+
+    // Interface Statistics Block with time range and number of packets
+    void writeStatistics(BufferedFile & file, const FileStats & stats) {
+        struct {
+            u_int32_t interface_id;
+            u_int32_t ts_high;
+            u_int32_t ts_low;
+        } isb = { 0, (u_int32_t) ((uint64_t) stats.mLastTs >> 32), (u_int32_t) stats.mLastTs };
+        u_int32_t start[2] = { (u_int32_t) ((uint64_t) stats.mFirstTs >> 32), (u_int32_t) stats.mFirstTs };
+        u_int32_t end[2] = { isb.ts_high, isb.ts_low };
+        uint64_t packets = stats.mPackets;
+        Option options[] = {
+            { PCAPNG_ISB_STARTTIME, start, sizeof(start) },
+            { PCAPNG_ISB_ENDTIME, end, sizeof(end) },
+            { PCAPNG_ISB_IFRECV, &packets, sizeof(packets) }
+        };
+        writeBlock(file, PCAPNG_ISB, &isb, sizeof(isb), options, 3);
+    }
+
+private:
+    std::unique_ptr<BufferedFile> mFile;
+    std::string mPath;         // of first file
+    std::string mFilePath;     // of current file
+    AddressResolver mResolver;
+    FORMAT mFormat;
+    size_t mBufferSize;
+    uint64_t mPreallocate;
+    Rotation mRotation;
+    FileFinisher mFinisher;
+    uint64_t mPackets;         // of all files
+    FileStats mStats;          // of current file
+    uint64_t mBytesDone;       // by finished files
+    unsigned mFiles;
+    SPLIT mSplit;
+    size_t mMaxOpen;
+    size_t mSplitBufferSize;
+    size_t mOpen;              // split outputs with open file
+    std::vector<Output> mOutputs;
+    std::unordered_map<std::string, u_int32_t> mOutputIds;
+    std::list<u_int32_t> mLru; // open outputs, most recently used first
+    int mZstdLevel;            // 0 - output isn't compressed while it's written
+    unsigned mZstdWorkers;
+    uint64_t mSkipped;         // messages without addresses
+    std::string mError;
+    ConnTable<TCPContext> mConns;
+    TCPContext * mTCPCtx;  // of current connection
+    SumFunc mSum;
+    std::vector<Slice> mGather;
+    PacketBatch mBatch;
 }; // PCapDumper
 
 } // namespace op
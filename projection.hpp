@@ -0,0 +1,106 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include "variant.hpp"
+#include <string>
+#include <vector>
+
+namespace op {
+
+/*
+ * Key paths of records needed by caller, e.g. "request.*" or
+ * "server_conn.ip_address". Whole subtree of path is taken, so trailing
+ * ".*" could be omitted. Vectors are transparent: path applies to their
+ * items. Paths are kept as trie of nodes, node 0 is record itself.
+ */
+
+class Projection {
+public:
+    enum {
+        ALL = -1,   // whole subtree is needed
+        SKIP = -2   // subtree isn't needed
+    };
+
+    Projection() {
+        mNodes.push_back(Node(std::string(), -1));
+    }
+    Projection(const char * const * paths, size_t count) {
+        mNodes.push_back(Node(std::string(), -1));
+        for (size_t i = 0; i < count; ++i) {
+            add(paths[i]);
+        }
+    }
+
+    void add(const std::string & path) {
+        int node = 0;
+        size_t pos = 0;
+        while (pos <= path.size() && !mNodes[node].mAll) {
+            size_t dot = path.find('.', pos);
+            if (dot == std::string::npos) dot = path.size();
+            std::string key = path.substr(pos, dot - pos);
+            if (key == "*" || key.empty())
+                break;
+            int next = find(node, key);
+            if (next < 0) {
+                mNodes.push_back(Node(key, node));
+                next = (int) mNodes.size() - 1;
+            }
+            node = next;
+            pos = dot + 1;
+        }
+        mNodes[node].mAll = true;
+    }
+
+    // node of key under node, ALL or SKIP
+    int child(int node, const StringRef & key) const {
+        if (node == ALL)
+            return ALL;
+        int next = find(node, key);
+        if (next < 0)
+            return SKIP;
+        return mNodes[next].mAll ? ALL : next;
+    }
+
+    int root() const {
+        return mNodes[0].mAll ? ALL : 0;
+    }
+
+private:
+    struct Node {
+        std::string mKey;
+        int mParent;
+        bool mAll;
+        Node(const std::string & key, int parent)
+            : mKey(key), mParent(parent), mAll(false)
+        {}
+    };
+
+    // paths are few, so nodes are scanned
+    int find(int parent, const StringRef & key) const {
+        for (size_t i = 1; i < mNodes.size(); ++i) {
+            if (mNodes[i].mParent == parent && StringRef(mNodes[i].mKey) == key)
+                return (int) i;
+        }
+        return -1;
+    }
+
+    std::vector<Node> mNodes;
+}; // Projection
+
+} // namespace op
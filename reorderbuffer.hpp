@@ -0,0 +1,114 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+
+namespace op {
+
+/*
+ * Window of events which arrive almost sorted by time. Events are held
+ * in a min-heap and released in timestamp order once window holds more
+ * than maxCount of them or newest event is more than maxSpan (nsecs)
+ * later than the oldest one. Zero limit isn't checked.
+ *
+ * Events older than already released one can't be put into order any
+ * more: they are released at once and counted as late.
+ *
+ * T must have operator< and be accepted by int64_t timeOf(const T &).
+ */
+
+template <class T>
+class ReorderBuffer {
+public:
+    ReorderBuffer(size_t maxCount, int64_t maxSpan)
+        : mMaxCount(maxCount)
+        , mMaxSpan(maxSpan)
+        , mNewest(INT64_MIN)
+        , mReleased(INT64_MIN)
+        , mLate(0)
+    {}
+
+    // put event into window, F is called for each released event
+    template <class F>
+    void push(const T & event, F release) {
+        int64_t ts = timeOf(event);
+        if (ts < mReleased) {
+            ++mLate;
+            release(event);
+            return;
+        }
+        mHeap.push_back(event);
+        std::push_heap(mHeap.begin(), mHeap.end(), greater);
+        if (ts > mNewest) mNewest = ts;
+        while (!mHeap.empty() && isFull()) {
+            pop(release);
+        }
+    }
+
+    // release all events
+    template <class F>
+    void flush(F release) {
+        while (!mHeap.empty()) {
+            pop(release);
+        }
+    }
+
+    size_t size() const {
+        return mHeap.size();
+    }
+    // number of events which came later than window allows
+    uint64_t late() const {
+        return mLate;
+    }
+
+private:
+    static bool greater(const T & a, const T & b) {
+        return b < a;
+    }
+
+    bool isFull() const {
+        if (mMaxCount != 0 && mHeap.size() > mMaxCount)
+            return true;
+        if (mMaxSpan != 0 && mNewest - timeOf(mHeap.front()) > mMaxSpan)
+            return true;
+        return false;
+    }
+
+    template <class F>
+    void pop(F & release) {
+        std::pop_heap(mHeap.begin(), mHeap.end(), greater);
+        T event = mHeap.back();
+        mHeap.pop_back();
+        int64_t ts = timeOf(event);
+        if (ts > mReleased) mReleased = ts;
+        release(event);
+    }
+
+    size_t mMaxCount;
+    int64_t mMaxSpan;
+    int64_t mNewest;
+    int64_t mReleased;
+    uint64_t mLate;
+    std::vector<T> mHeap;
+}; // ReorderBuffer
+
+} // namespace op
@@ -0,0 +1,190 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#endif
+
+#include "threadpool.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+namespace op {
+
+/*
+ * IPv4 and IPv6 addresses of host. Host could have one of them, both
+ * or none if it wasn't resolved.
+ */
+
+struct HostAddress {
+    bool mHasIPv4;
+    bool mHasIPv6;
+    in_addr mIPv4;
+    in6_addr mIPv6;
+
+    HostAddress()
+        : mHasIPv4(false)
+        , mHasIPv6(false)
+    {
+        memset(&mIPv4, 0, sizeof(mIPv4));
+        memset(&mIPv6, 0, sizeof(mIPv6));
+    }
+}; // HostAddress
+
+/*
+ * Cache of host name resolution. Each name is given to getaddrinfo()
+ * once. prefetch() resolves set of names concurrently, so conversion
+ * doesn't wait for DNS round trip per name.
+ *
+ * In offline mode resolver is never called: names which are not address
+ * literals get stable synthetic addresses from 10.0.0.0/8 and fd00::/8
+ * made of hash of name.
+ */
+
+class AddressResolver {
+public:
+    AddressResolver()
+        : mOffline(false)
+    {}
+
+    void setOffline(bool offline) {
+        mOffline = offline;
+    }
+    bool isOffline() const {
+        return mOffline;
+    }
+
+    const HostAddress & resolve(const std::string & host) {
+        Cache::const_iterator it = mCache.find(host);
+        if (it != mCache.end())
+            return it->second;
+        return mCache[host] = lookup(host, mOffline);
+    }
+    const HostAddress & resolve(const char * host, size_t len) {
+        // buffer keeps its capacity, so cached names are found without allocation
+        mKey.assign(host, len);
+        return resolve(mKey);
+    }
+
+    // resolve names not cached yet using not more than `threads` lookups at once
+    void prefetch(const std::vector<std::string> & hosts, unsigned threads = 16) {
+        std::vector<std::string> todo;
+        for (size_t i = 0; i < hosts.size(); ++i) {
+            if (mCache.find(hosts[i]) == mCache.end())
+                todo.push_back(hosts[i]);
+        }
+        std::sort(todo.begin(), todo.end());
+        todo.erase(std::unique(todo.begin(), todo.end()), todo.end());
+
+        std::vector<HostAddress> found(todo.size());
+        struct Lookup {
+            const std::vector<std::string> & mHosts;
+            std::vector<HostAddress> & mFound;
+            bool mOffline;
+            void operator()(size_t index, unsigned) const {
+                mFound[index] = AddressResolver::lookup(mHosts[index], mOffline);
+            }
+        } job = { todo, found, mOffline };
+        parallelFor(std::min<size_t>(threads, todo.size()), todo.size(), job);
+        for (size_t i = 0; i < todo.size(); ++i) {
+            mCache[todo[i]] = found[i];
+        }
+    }
+
+    size_t size() const {
+        return mCache.size();
+    }
+
+    static HostAddress lookup(const std::string & host, bool offline) {
+        HostAddress ret;
+        if (inet_pton(AF_INET, host.c_str(), &ret.mIPv4) == 1) {
+            ret.mHasIPv4 = true;
+            return ret;
+        }
+        if (inet_pton(AF_INET6, host.c_str(), &ret.mIPv6) == 1) {
+            ret.mHasIPv6 = true;
+            return ret;
+        }
+        if (offline) {
+            synthetic(host, ret);
+            return ret;
+        }
+        struct addrinfo hints, *list = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), NULL, &hints, &list) != 0)
+            return ret;
+        for (struct addrinfo * p = list; p != NULL; p = p->ai_next) {
+            if (p->ai_family == AF_INET && !ret.mHasIPv4) {
+                ret.mIPv4 = ((const struct sockaddr_in *) p->ai_addr)->sin_addr;
+                ret.mHasIPv4 = true;
+            } else if (p->ai_family == AF_INET6 && !ret.mHasIPv6) {
+                ret.mIPv6 = ((const struct sockaddr_in6 *) p->ai_addr)->sin6_addr;
+                ret.mHasIPv6 = true;
+            }
+        }
+        freeaddrinfo(list);
+        return ret;
+    }
+
+private:
+    // FNV-1a
+    static uint64_t hash(const std::string & str, uint64_t seed) {
+        uint64_t h = 14695981039346656037ULL ^ seed;
+        for (size_t i = 0; i < str.size(); ++i) {
+            h ^= (unsigned char) str[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static void synthetic(const std::string & host, HostAddress & ret) {
+        uint64_t h1 = hash(host, 0);
+        uint64_t h2 = hash(host, h1);
+        // 10.x.x.x, network and broadcast addresses are avoided
+        uint32_t low = (uint32_t) (h1 % 0xFFFFFE) + 1;
+        ret.mIPv4.s_addr = htonl(0x0A000000 | low);
+        ret.mHasIPv4 = true;
+        // fdxx:...
+        unsigned char * b = (unsigned char *) &ret.mIPv6;
+        b[0] = 0xfd;
+        for (int i = 1; i < 8; ++i) b[i] = (unsigned char) (h1 >> (8 * i));
+        for (int i = 8; i < 16; ++i) b[i] = (unsigned char) (h2 >> (8 * (i - 8)));
+        ret.mHasIPv6 = true;
+    }
+
+    typedef std::unordered_map<std::string, HostAddress> Cache;
+    Cache mCache;
+    std::string mKey;
+    bool mOffline;
+}; // AddressResolver
+
+} // namespace op
@@ -0,0 +1,158 @@
+// ///////////////////////////////////////////////////////////////////////// //
+//                                                                           //
+//   Copyright (C) 2018 by Oleg Polivets                                     //
+//   jsbot@ya.ru                                                             //
+//                                                                           //
+//   This program is free software; you can redistribute it and/or modify    //
+//   it under the terms of the GNU General Public License as published by    //
+//   the Free Software Foundation; either version 2 of the License, or       //
+//   (at your option) any later version.                                     //
+//                                                                           //
+//   This program is distributed in the hope that it will be useful,         //
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of          //
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           //
+//   GNU General Public License for more details.                            //
+//                                                                           //
+// ///////////////////////////////////////////////////////////////////////// //
+
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <functional>
+
+namespace op {
+
+// number of hardware threads, at least one
+inline unsigned hardwareThreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+/*
+ * Call f(index, worker) for each index in [0, count) on `threads` workers.
+ * Indexes are handed out in batches of `batch` items, so workers with
+ * cheap items take more of them. Returns when all items are done.
+ */
+
+template <class F>
+void parallelFor(unsigned threads, size_t count, F f, size_t batch = 1) {
+    if (threads <= 1 || count <= batch) {
+        for (size_t i = 0; i < count; ++i) {
+            f(i, 0u);
+        }
+        return;
+    }
+    std::atomic<size_t> next(0);
+    struct Worker {
+        static void run(F & f, std::atomic<size_t> & next, size_t count,
+                        size_t batch, unsigned worker) {
+            for (;;) {
+                size_t begin = next.fetch_add(batch);
+                if (begin >= count) break;
+                size_t end = (begin + batch < count ? begin + batch : count);
+                for (size_t i = begin; i < end; ++i) {
+                    f(i, worker);
+                }
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned w = 1; w < threads; ++w) {
+        workers.push_back(std::thread(Worker::run, std::ref(f), std::ref(next),
+                                      count, batch, w));
+    }
+    Worker::run(f, next, count, batch, 0);
+    for (size_t w = 0; w < workers.size(); ++w) {
+        workers[w].join();
+    }
+}
+
+/*
+ * Produce `count` batches on `threads` workers and consume them on one
+ * writer thread in order of their indexes:
+ *     produce(index, batch) - fills batch, called on any worker;
+ *     consume(batch)        - called on writer for index 0, 1, 2...
+ * Not more than `inFlight` batches exist at the same time, their memory
+ * is reused for next indexes.
+ */
+
+template <class Batch, class P, class C>
+void orderedPipeline(unsigned threads, size_t count, P produce, C consume, size_t inFlight) {
+    if (inFlight < 1) inFlight = 1;
+    struct Slot {
+        Batch mBatch;
+        bool mReady;
+        Slot() : mReady(false)
+        {}
+    };
+    std::vector<Slot> slots(inFlight);
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t next = 0;       // index of batch for next worker
+    size_t consumed = 0;   // number of batches written
+
+    struct Worker {
+        static void run(P & produce, std::vector<Slot> & slots, std::mutex & mutex,
+                        std::condition_variable & changed, size_t & next,
+                        size_t & consumed, size_t count) {
+            for (;;) {
+                size_t index;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (next >= count) break;
+                    index = next++;
+                    while (index >= consumed + slots.size()) {
+                        changed.wait(lock);
+                    }
+                }
+                Slot & slot = slots[index % slots.size()];
+                produce(index, slot.mBatch);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    slot.mReady = true;
+                }
+                changed.notify_all();
+            }
+        }
+    };
+    struct Writer {
+        static void run(C & consume, std::vector<Slot> & slots, std::mutex & mutex,
+                        std::condition_variable & changed, size_t & consumed, size_t count) {
+            for (size_t index = 0; index < count; ++index) {
+                Slot & slot = slots[index % slots.size()];
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    while (!slot.mReady) {
+                        changed.wait(lock);
+                    }
+                }
+                consume(slot.mBatch);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    slot.mReady = false;
+                    ++consumed;
+                }
+                changed.notify_all();
+            }
+        }
+    };
+
+    std::thread writer(Writer::run, std::ref(consume), std::ref(slots), std::ref(mutex),
+                       std::ref(changed), std::ref(consumed), count);
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < (threads ? threads : 1); ++w) {
+        workers.push_back(std::thread(Worker::run, std::ref(produce), std::ref(slots),
+                                      std::ref(mutex), std::ref(changed), std::ref(next),
+                                      std::ref(consumed), count));
+    }
+    for (size_t w = 0; w < workers.size(); ++w) {
+        workers[w].join();
+    }
+    writer.join();
+}
+
+} // namespace op
@@ -19,18 +19,249 @@
 
 #include <iostream>
 #include <string>
-#include <vector>
-#include <map>
-#include <memory>
+#include <algorithm>
+#include <stdexcept>
 #include <iomanip>
 #include <cassert>
+#include <cstring>
+#include <stdint.h>
+#include "arena.hpp"
+#include "numbers.hpp"
 
 namespace op {
 
+/*
+ * Non-owning reference to characters kept somewhere else (arena, input
+ * buffer or string literal).
+ */
+
+class StringRef {
+public:
+    StringRef() : mData(""), mSize(0)
+    {}
+    StringRef(const char * data, size_t size) : mData(data), mSize(size)
+    {}
+    StringRef(const char * str) : mData(str), mSize(::strlen(str))
+    {}
+    StringRef(const std::string & str) : mData(str.data()), mSize(str.size())
+    {}
+
+    const char * data() const {
+        return mData;
+    }
+    size_t size() const {
+        return mSize;
+    }
+    size_t length() const {
+        return mSize;
+    }
+    bool empty() const {
+        return mSize == 0;
+    }
+    const char * begin() const {
+        return mData;
+    }
+    const char * end() const {
+        return mData + mSize;
+    }
+    char operator[](size_t idx) const {
+        assert(idx < mSize);
+        return mData[idx];
+    }
+    std::string str() const {
+        return std::string(mData, mSize);
+    }
+
+    int compare(const StringRef & other) const {
+        size_t len = (mSize < other.mSize ? mSize : other.mSize);
+        int rv = (len ? ::memcmp(mData, other.mData, len) : 0);
+        if (rv != 0) return rv;
+        return (mSize < other.mSize ? -1 : (mSize > other.mSize ? 1 : 0));
+    }
+    bool operator<(const StringRef & other) const {
+        return compare(other) < 0;
+    }
+    bool operator==(const StringRef & other) const {
+        return mSize == other.mSize && !::memcmp(mData, other.mData, mSize);
+    }
+    bool operator!=(const StringRef & other) const {
+        return !(*this == other);
+    }
+
+private:
+    const char * mData;
+    size_t mSize;
+}; // StringRef
+
+inline std::ostream & operator<<(std::ostream & os, const StringRef & str) {
+    return os.write(str.data(), str.size());
+}
+
+// Variant nodes live in Arena and are referenced by raw pointers; the
+// whole tree is released together with its arena.
 class Variant;
-typedef std::shared_ptr<Variant> VariantPtr;
-typedef std::vector<VariantPtr> ValuesVector;
-typedef std::map<std::string, VariantPtr> KeyValueMap;
+typedef Variant * VariantPtr;
+
+/*
+ * Array of node items placed in Arena. It's a plain struct so it can be
+ * kept inside of Variant's union, memory for new items is taken from
+ * arena passed by caller.
+ */
+
+class ValuesVector {
+public:
+    typedef const VariantPtr * const_iterator;
+    typedef VariantPtr * iterator;
+
+    void init() {
+        mItems = nullptr;
+        mSize = mCapacity = 0;
+    }
+
+    void reserve(Arena & arena, size_t count) {
+        if (count <= mCapacity) return;
+        VariantPtr * items = arena.allocate<VariantPtr>(count);
+        if (mSize) memcpy(items, mItems, mSize * sizeof(VariantPtr));
+        mItems = items;
+        mCapacity = (uint32_t) count;
+    }
+    void push_back(Arena & arena, VariantPtr item) {
+        if (mSize == mCapacity)
+            reserve(arena, mCapacity ? mCapacity * 2 : 4);
+        mItems[mSize++] = item;
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+    bool empty() const {
+        return mSize == 0;
+    }
+    VariantPtr operator[](size_t idx) const {
+        assert(idx < mSize);
+        return mItems[idx];
+    }
+    VariantPtr at(size_t idx) const {
+        if (idx >= mSize) throw std::out_of_range("ValuesVector::at");
+        return mItems[idx];
+    }
+    iterator begin() {
+        return mItems;
+    }
+    iterator end() {
+        return mItems + mSize;
+    }
+    const_iterator begin() const {
+        return mItems;
+    }
+    const_iterator end() const {
+        return mItems + mSize;
+    }
+
+private:
+    VariantPtr * mItems;
+    uint32_t mSize;
+    uint32_t mCapacity;
+}; // ValuesVector
+
+/*
+ * Map node as array of key/value pairs sorted by key. Pairs are appended
+ * while parsing and sorted once by finish().
+ */
+
+class KeyValueMap {
+public:
+    struct Pair {
+        StringRef first;
+        VariantPtr second;
+        bool operator<(const Pair & other) const {
+            return first < other.first;
+        }
+    };
+    typedef const Pair * const_iterator;
+    typedef Pair * iterator;
+
+    void init() {
+        mPairs = nullptr;
+        mSize = mCapacity = 0;
+    }
+
+    void reserve(Arena & arena, size_t count) {
+        if (count <= mCapacity) return;
+        Pair * pairs = arena.allocate<Pair>(count);
+        if (mSize) memcpy(pairs, mPairs, mSize * sizeof(Pair));
+        mPairs = pairs;
+        mCapacity = (uint32_t) count;
+    }
+    void append(Arena & arena, const StringRef & key, VariantPtr value) {
+        if (mSize == mCapacity)
+            reserve(arena, mCapacity ? mCapacity * 2 : 4);
+        Pair & pair = mPairs[mSize++];
+        pair.first = key;
+        pair.second = value;
+    }
+    // sort appended pairs, the last one wins for duplicated keys
+    void finish() {
+        // maps are small, so stable insertion sort without temporary buffer
+        for (uint32_t i = 1; i < mSize; ++i) {
+            Pair pair = mPairs[i];
+            uint32_t j = i;
+            for (; j > 0 && pair < mPairs[j-1]; --j) {
+                mPairs[j] = mPairs[j-1];
+            }
+            mPairs[j] = pair;
+        }
+        uint32_t j = 0;
+        for (uint32_t i = 0; i < mSize; ++i) {
+            if (j > 0 && mPairs[j-1].first == mPairs[i].first) {
+                mPairs[j-1] = mPairs[i];
+            } else {
+                mPairs[j++] = mPairs[i];
+            }
+        }
+        mSize = j;
+    }
+
+    const_iterator find(const StringRef & key) const {
+        const_iterator it = std::lower_bound(begin(), end(), key, lessKey);
+        return (it != end() && it->first == key) ? it : end();
+    }
+    // value for key or nullptr when it's absent
+    VariantPtr operator[](const StringRef & key) const {
+        const_iterator it = find(key);
+        return (it != end()) ? it->second : nullptr;
+    }
+
+    size_t size() const {
+        return mSize;
+    }
+    bool empty() const {
+        return mSize == 0;
+    }
+    const_iterator begin() const {
+        return mPairs;
+    }
+    const_iterator end() const {
+        return mPairs + mSize;
+    }
+
+private:
+    static bool lessKey(const Pair & pair, const StringRef & key) {
+        return pair.first < key;
+    }
+
+    Pair * mPairs;
+    uint32_t mSize;
+    uint32_t mCapacity;
+}; // KeyValueMap
+
+/*
+ * Tree node. Storage depends on data type: numbers, string or items of
+ * map/vector share the same union. Short strings are kept inside of node,
+ * longer ones are copied into arena. Parsed numbers and booleans keep
+ * their source text too, so they are printed and given by asString()
+ * as they were written.
+ */
 
 class Variant {
 public:
@@ -41,88 +272,122 @@ public:
         vtFloat,
         vtDouble,
         vtRepeated,
-        vtNode
+        vtNode,
+        vtBoolean
     };
 
-    explicit Variant(TYPE dataType = vtEmpty) : mDataType(dataType)
-    {}
-
-    explicit Variant(const char* string, unsigned lenght)
-        : mDataType(vtString)
-        , mString(string, lenght)
-    {}
-
-    explicit Variant(int64_t value) : mDataType(vtInteger) {
-        mData.i = value;
-    }
-
-    explicit Variant(double value) : mDataType(vtDouble) {
-        mData.d = value;
-    }
-
-    explicit Variant(float value) : mDataType(vtFloat) {
-        mData.f = value;
+    static VariantPtr make(Arena & arena) {
+        return make(arena, vtEmpty);
+    }
+    static VariantPtr makeMap(Arena & arena) {
+        VariantPtr var = make(arena, vtNode);
+        var->mData.map.init();
+        return var;
+    }
+    static VariantPtr makeRepeated(Arena & arena) {
+        VariantPtr var = make(arena, vtRepeated);
+        var->mData.vec.init();
+        return var;
+    }
+    static VariantPtr make(Arena & arena, const char * data, unsigned lenght) {
+        VariantPtr var = make(arena, vtString);
+        var->mSize = lenght;
+        if (lenght < sizeof(var->mData.sso)) {
+            memcpy(var->mData.sso, data, lenght);
+            var->mData.sso[lenght] = '\0';
+        } else {
+            var->mData.str = arena.copy(data, lenght);
+        }
+        return var;
+    }
+    // long string isn't copied, data must live as long as variant
+    static VariantPtr makeRef(Arena & arena, const char * data, unsigned lenght) {
+        if (lenght < sizeof(((Variant*) 0)->mData.sso))
+            return make(arena, data, lenght);
+        VariantPtr var = make(arena, vtString);
+        var->mSize = lenght;
+        var->mData.str = data;
+        return var;
+    }
+    static VariantPtr make(Arena & arena, int64_t value) {
+        VariantPtr var = make(arena, vtInteger);
+        var->mData.num.i = value;
+        var->mData.num.text = nullptr;
+        return var;
+    }
+    static VariantPtr make(Arena & arena, double value) {
+        VariantPtr var = make(arena, vtDouble);
+        var->mData.num.d = value;
+        var->mData.num.text = nullptr;
+        return var;
+    }
+    static VariantPtr make(Arena & arena, float value) {
+        VariantPtr var = make(arena, vtFloat);
+        var->mData.num.f = value;
+        var->mData.num.text = nullptr;
+        return var;
+    }
+    // typed value of tnetstring ('#', '^' or '!') or nullptr if text isn't
+    // valid one; text must live as long as variant
+    static VariantPtr parse(Arena & arena, char type, const char * text, unsigned lenght) {
+        VariantPtr var = nullptr;
+        const char * end = text + lenght;
+        int64_t i;
+        double d;
+        if (type == '#' && parseInt(text, end, i)) {
+            var = make(arena, i);
+        } else if (type == '^' && parseDouble(text, end, d)) {
+            var = make(arena, d);
+        } else if (type == '!' && (StringRef(text, lenght) == "true" ||
+                                   StringRef(text, lenght) == "false")) {
+            var = make(arena, vtBoolean);
+            var->mData.num.i = (lenght == 4);
+        } else {
+            return nullptr;
+        }
+        var->mSize = lenght;
+        var->mData.num.text = text;
+        return var;
     }
 
-    ~Variant() {}
-
     template <class T>
     bool hasField(const T & index) const {
         assert(isMap());
-        KeyValueMap::const_iterator it = mNodes.find(index);
-        return (it != mNodes.end());
+        return asMap().find(index) != asMap().end();
     }
 
     template <class T>
     VariantPtr operator[] (const T & idx) {
         if (isMap()) {
-            return mNodes[idx];
+            return asMap()[idx];
         } else if (isRepeated()) {
-            return mItems[idx];
+            return asVector()[idx];
         }
         assert(!"this shouldn't happen");
         return nullptr;
     }
 
-    static VariantPtr make() {
-        return VariantPtr(new Variant());
-    }
-    static VariantPtr makeMap() {
-        return VariantPtr(new Variant(vtNode));
-    }
-    static VariantPtr makeRepeated() {
-        return VariantPtr(new Variant(vtRepeated));
-    }
-    static VariantPtr make(const char * data, unsigned lenght) {
-        return VariantPtr(new Variant(data, lenght));
-    }
-    template <class T>
-    static VariantPtr make(T value) {
-        return VariantPtr(new Variant(value));
-    }
-
     bool isRepeated() const {
         return mDataType == vtRepeated;
     }
     ValuesVector & asVector() {
         assert(isRepeated());
-        return mItems;
+        return mData.vec;
     }
     const ValuesVector & asVector() const {
         assert(isRepeated());
-        return mItems;
+        return mData.vec;
     }
 
     bool isString() const {
         return mDataType == vtString;
     }
-    const std::string & asString() const {
+    // string or source text of parsed number/boolean
+    StringRef asString() const {
+        if (hasText())
+            return StringRef(mData.num.text, mSize);
         assert(isString());
-        return mString;
-    }
-    std::string & asString() {
-//        assert(isString());
-        return mString;
+        return StringRef(mSize < sizeof(mData.sso) ? mData.sso : mData.str, mSize);
     }
 
     bool isInt() const {
@@ -130,11 +395,11 @@ public:
     }
     int64_t asInt() const {
         assert(isInt());
-        return mData.i;
+        return mData.num.i;
     }
     int64_t& asInt() {
         assert(isInt());
-        return mData.i;
+        return mData.num.i;
     }
 
     bool isFloat() const {
@@ -142,11 +407,11 @@ public:
     }
     float asFloat() const {
         assert(isFloat());
-        return mData.f;
+        return mData.num.f;
     }
     float& asFloat() {
         assert(isFloat());
-        return mData.f;
+        return mData.num.f;
     }
 
     bool isDouble() const {
@@ -154,11 +419,43 @@ public:
     }
     double asDouble() const {
         assert(isDouble());
-        return mData.d;
+        return mData.num.d;
     }
     double& asDouble() {
         assert(isDouble());
-        return mData.d;
+        return mData.num.d;
+    }
+
+    bool isBool() const {
+        return mDataType == vtBoolean;
+    }
+    bool asBool() const {
+        assert(isBool());
+        return mData.num.i != 0;
+    }
+
+    // seconds of number as nanoseconds; parsed text gives exact value
+    // where double would lose digits of fraction. Values which don't fit
+    // into int64_t nanoseconds aren't accepted
+    bool asNanos(int64_t & ns) const {
+        const int64_t MAX_SEC = INT64_MAX / 1000000000;
+        if (isInt()) {
+            if (mData.num.i > MAX_SEC || mData.num.i < -MAX_SEC)
+                return false;
+            ns = mData.num.i * 1000000000;
+            return true;
+        }
+        if (!isDouble())
+            return false;
+        if (mData.num.text != nullptr &&
+            parseNanos(mData.num.text, mData.num.text + mSize, ns))
+            return true;
+        // 2^63 as double; NaN fails too
+        double value = mData.num.d * 1e9;
+        if (!(value < 9223372036854775808.0 && value > -9223372036854775808.0))
+            return false;
+        ns = (int64_t) value;
+        return true;
     }
 
     bool isMap() const {
@@ -166,24 +463,18 @@ public:
     }
     const KeyValueMap & asMap() const {
         assert(isMap());
-        return mNodes;
+        return mData.map;
     }
     KeyValueMap & asMap() {
         assert(isMap());
-        return mNodes;
+        return mData.map;
     }
     template <class T>
-    const std::string & asStringMap(const T & idx) const {
-        assert(isMap());
-        KeyValueMap::const_iterator it = mNodes.find(idx);
-        assert(it != mNodes.end());
+    StringRef asStringMap(const T & idx) const {
+        KeyValueMap::const_iterator it = asMap().find(idx);
+        assert(it != asMap().end());
         return it->second->asString();
     }
-    template <class T>
-    std::string & asStringMap(const T & idx) {
-        assert(isMap());
-        return mNodes[idx]->asString();
-    }
 
     const char* dataType() const {
         switch (mDataType) {
@@ -191,6 +482,7 @@ public:
         case vtDouble:   return "double";
         case vtString:   return "string";
         case vtFloat:    return "float";
+        case vtBoolean:  return "bool";
         case vtRepeated: return "vector";
         case vtNode:     return "map";
         default: {
@@ -284,21 +576,45 @@ public:
     // /////////////////////////////////////////////////////////////////// //
 
 private:
-    TYPE mDataType;
-    union {              // wrap access to int, float and double data types
-        int64_t i;
-        float f;
-        double d;
+    bool hasText() const {
+        return (mDataType == vtInteger || mDataType == vtDouble ||
+                mDataType == vtFloat || mDataType == vtBoolean) &&
+               mData.num.text != nullptr;
+    }
+
+    static VariantPtr make(Arena & arena, TYPE dataType) {
+        VariantPtr var = arena.allocate<Variant>(1);
+        var->mDataType = dataType;
+        var->mSize = 0;
+        return var;
+    }
+
+    uint8_t mDataType;
+    uint32_t mSize;          // length of vtString or of number's text
+    union {
+        struct {
+            union {
+                int64_t i;   // vtInteger, vtBoolean
+                float f;
+                double d;
+            };
+            const char * text;  // source of parsed value or nullptr
+        } num;
+        char sso[16];        // vtString shorter than 16 chars
+        const char * str;    // vtString kept in arena
+        KeyValueMap map;     // vtNode
+        ValuesVector vec;    // vtRepeated
     } mData;
-    std::string mString; // data for vtString and content of message for vtMap
-    KeyValueMap mNodes;  // subnodes vtMap data type
-    ValuesVector mItems; // for vtRepeated
 }; // Variant
 
 // /////////////////////////////////////////////////////////////////// //
 
 inline std::ostream & operator<<(std::ostream & os, const Variant & var) {
-    if (var.isInt()) {
+    if (var.hasText()) {
+        os << var.asString();
+    } else if (var.isBool()) {
+        os << (var.asBool() ? "true" : "false");
+    } else if (var.isInt()) {
         os /*<< "int64:"*/ << std::dec << var.asInt();
     } else if (var.isFloat()) {
         os /*<< "float:"*/ << var.asFloat();
@@ -306,7 +622,7 @@ inline std::ostream & operator<<(std::ostream & os, const Variant & var) {
         os /*<< "double:"*/ << var.asDouble();
     } else if (var.isString()) {
         os << '"';
-        const std::string & str = var.asString();
+        StringRef str = var.asString();
         for (unsigned i = 0; i < str.length(); ++i) {
             bool outAsHex = ((str[i] >=0x00 && str[i] <= 0x1F) /* || ch > 0x7f */);
             if (!outAsHex) {